@@ -0,0 +1,68 @@
+#pragma once
+// Helpers shared by the benchmark programs. Each program is a single translation unit built on
+// its own, so everything here is inline.
+#include <cstdio>
+#include <cstdarg>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "Store.h"
+
+// Only warnings and errors, so informational output of the stages does not skew timings.
+inline void benchLogger(unsigned level, const char* msg, ...)
+{
+  if (level == 0) return;
+  va_list argptr;
+  va_start(argptr, msg);
+  vfprintf(stderr, msg, argptr);
+  va_end(argptr);
+  fprintf(stderr, "\n");
+}
+
+inline bool readFile(std::vector<char>& data, const std::string& path)
+{
+  FILE* in = fopen(path.c_str(), "rb");
+  if (in == nullptr) return false;
+  fseek(in, 0, SEEK_END);
+  data.resize(size_t(ftell(in)));
+  fseek(in, 0, SEEK_SET);
+  bool ok = fread(data.data(), 1, data.size(), in) == data.size();
+  fclose(in);
+  return ok;
+}
+
+inline uint64_t fileSize(const std::string& path)
+{
+  FILE* in = fopen(path.c_str(), "rb");
+  if (in == nullptr) return 0;
+  fseek(in, 0, SEEK_END);
+  uint64_t size = uint64_t(ftell(in));
+  fclose(in);
+  return size;
+}
+
+// The rev format has no spheres, drop them from generated models before writing rev files.
+inline void removeSpheres(Store* store)
+{
+  struct Recurse {
+    static void run(Node* node)
+    {
+      if (node->kind == Node::Kind::Group) {
+        ListHeader<Geometry> geometries = node->group.geometries;
+        node->group.geometries.clear();
+        while (Geometry* geo = geometries.popFront()) {
+          if (geo->kind != Geometry::Kind::Sphere) node->group.geometries.insert(geo);
+        }
+      }
+      for (auto * child = node->children.first; child; child = child->next) {
+        run(child);
+      }
+    }
+  };
+  for (auto * root = store->getFirstRoot(); root; root = root->next) {
+    Recurse::run(root);
+  }
+  store->updateCounts();
+}
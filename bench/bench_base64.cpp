@@ -0,0 +1,78 @@
+// Measures base64 encoding throughput of the encoder used for .gltf data uris, compared
+// to a plain one-character-per-lookup encoder.
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+
+#include "Base64.h"
+
+namespace {
+
+  void encodeBytewise(char* dst, const uint8_t* data, size_t byteLength)
+  {
+    static const char rfc4648[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 3 <= byteLength; i += 3) {
+      const uint8_t d0 = data[i + 0];
+      const uint8_t d1 = data[i + 1];
+      const uint8_t d2 = data[i + 2];
+      *dst++ = rfc4648[(d0 >> 2)];
+      *dst++ = rfc4648[((d0 << 4) & 0x30) | (d1 >> 4)];
+      *dst++ = rfc4648[((d1 << 2) & 0x3c) | (d2 >> 6)];
+      *dst++ = rfc4648[d2 & 0x3f];
+    }
+    if (i < byteLength) {
+      const bool two = (i + 1 < byteLength);
+      const uint8_t d0 = data[i + 0];
+      const uint8_t d1 = two ? data[i + 1] : 0;
+      *dst++ = rfc4648[(d0 >> 2)];
+      *dst++ = rfc4648[((d0 << 4) & 0x30) | (d1 >> 4)];
+      *dst++ = two ? rfc4648[((d1 << 2) & 0x3c)] : '=';
+      *dst++ = '=';
+    }
+  }
+
+  template<typename F>
+  double measure(const char* name, F encode, const std::vector<uint8_t>& input, std::vector<char>& output, unsigned iterations)
+  {
+    encode(output.data(), input.data(), input.size());  // warm up
+
+    auto time0 = std::chrono::high_resolution_clock::now();
+    for (unsigned k = 0; k < iterations; k++) {
+      encode(output.data(), input.data(), input.size());
+    }
+    auto time1 = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(time1 - time0).count();
+    double mbPerSecond = (double(input.size()) * iterations) / (1024.0 * 1024.0 * seconds);
+    fprintf(stderr, "%-10s %8.1f MB/s\n", name, mbPerSecond);
+    return mbPerSecond;
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  size_t megabytes = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : 64;
+  unsigned iterations = 2 < argc ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 10;
+
+  std::vector<uint8_t> input(megabytes * 1024 * 1024 + 1);
+  uint32_t state = 1;
+  for (uint8_t& byte : input) {
+    state = 1664525u * state + 1013904223u;
+    byte = static_cast<uint8_t>(state >> 24);
+  }
+  std::vector<char> output(base64EncodedLength(input.size()));
+  std::vector<char> reference(output.size());
+
+  fprintf(stderr, "base64: %zu MB x %u iterations\n", megabytes, iterations);
+  measure("bytewise", encodeBytewise, input, reference, iterations);
+  measure("encoder", base64Encode, input, output, iterations);
+
+  if (output != reference) {
+    fprintf(stderr, "base64: output mismatch\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
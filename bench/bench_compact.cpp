@@ -0,0 +1,87 @@
+// Measures traversal time before and after Store::compact on a store made by generateModel and
+// laid out like a parsed one: facet group data interleaved with the geometries, and attributes
+// added in a second pass over the hierarchy, as when an attribute file is read after the model.
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+
+#include "Common.h"
+#include "Store.h"
+#include "Generator.h"
+#include "BenchCommon.h"
+#include "AddGroupBBox.h"
+#include "AddStats.h"
+
+namespace {
+
+  // Attributes in a second pass, in the same order as the hierarchy.
+  void addAttributes(Store* store)
+  {
+    const char* key = store->strings.intern("Description");
+    const char* val = store->strings.intern("Synthetic");
+    struct Recurse {
+      static void run(Store* store, Node* node, const char* key, const char* val)
+      {
+        if (node->kind == Node::Kind::Group) {
+          for (unsigned k = 0; k < 3; k++) store->newAttribute(node, key)->val = val;
+        }
+        for (auto * child = node->children.first; child != nullptr; child = child->next) {
+          run(store, child, key, val);
+        }
+      }
+    };
+    for (auto * root = store->getFirstRoot(); root != nullptr; root = root->next) {
+      Recurse::run(store, root, key, val);
+    }
+  }
+
+  template<typename Visitor>
+  double run(Store* store, unsigned iterations)
+  {
+    double best = 1e30;
+    for (unsigned k = 0; k < iterations; k++) {
+      Visitor visitor;
+      auto time0 = std::chrono::high_resolution_clock::now();
+      store->traverse(visitor);
+      auto time1 = std::chrono::high_resolution_clock::now();
+      best = std::min(best, std::chrono::duration<double, std::milli>(time1 - time0).count());
+    }
+    return best;
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  size_t geometries = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+  unsigned iterations = 2 < argc ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 5;
+
+  GeneratorOptions options;
+  options.sites = generatorSitesForGeometries(options, geometries);
+  options.attributesPerGroup = 0;
+  Store* store = new Store();
+  generateModel(store, benchLogger, options);
+  addAttributes(store);
+  fprintf(stderr, "compact: %u groups, %u geometries\n", store->groupCount_(), store->geometryCount_());
+
+  double bboxBefore = run<AddGroupBBox>(store, iterations);
+  double statsBefore = run<AddStats>(store, iterations);
+  size_t bytesBefore = store->arena.stats.bytesReserved;
+
+  auto time0 = std::chrono::high_resolution_clock::now();
+  store->compact();
+  auto time1 = std::chrono::high_resolution_clock::now();
+  double compactMs = std::chrono::duration<double, std::milli>(time1 - time0).count();
+
+  double bboxAfter = run<AddGroupBBox>(store, iterations);
+  double statsAfter = run<AddStats>(store, iterations);
+
+  fprintf(stderr, "compact: compact       %8.1fms  arena %zumb -> %zumb\n", compactMs,
+          bytesBefore >> 20, store->arena.stats.bytesReserved >> 20);
+  fprintf(stderr, "compact: AddGroupBBox  before %8.1fms  after %8.1fms  %.2fx\n", bboxBefore, bboxAfter, bboxBefore / bboxAfter);
+  fprintf(stderr, "compact: AddStats      before %8.1fms  after %8.1fms  %.2fx\n", statsBefore, statsAfter, statsBefore / statsAfter);
+
+  delete store;
+  return EXIT_SUCCESS;
+}
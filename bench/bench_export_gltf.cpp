@@ -0,0 +1,55 @@
+// Measures end-to-end glTF export time of a generated model after tessellation, for the export
+// variants that matter for buffer handling.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <chrono>
+
+#include "Common.h"
+#include "Store.h"
+#include "Generator.h"
+#include "BenchCommon.h"
+#include "Tessellator.h"
+
+namespace {
+
+  void measure(Store* store, const char* label, const std::string& path, bool mergeGeometries, bool quantize, bool meshopt)
+  {
+    auto time0 = std::chrono::high_resolution_clock::now();
+    bool ok = exportGLTF(store, benchLogger, path.c_str(), 0, true, true, false, mergeGeometries, quantize, meshopt, 1);
+    auto time1 = std::chrono::high_resolution_clock::now();
+
+    fprintf(stderr, "%-24s %s %8.1f ms %10.1f KB\n", label, ok ? "  " : "!!",
+            std::chrono::duration<double, std::milli>(time1 - time0).count(), fileSize(path) / 1024.0);
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  size_t geometries = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  std::string stem = 2 < argc ? argv[2] : "bench_export_gltf";
+
+  GeneratorOptions options;
+  options.sites = generatorSitesForGeometries(options, geometries);
+  Store* store = new Store();
+  generateModel(store, benchLogger, options);
+
+  Tessellator tessellator(benchLogger, 0.01f, -1.f, -1.f, 100);
+  store->apply(&tessellator);
+  fprintf(stderr, "export_gltf: %u groups, %u geometries, %llu vertices, %llu triangles\n",
+          store->groupCount_(), store->geometryCount_(),
+          static_cast<unsigned long long>(tessellator.vertices),
+          static_cast<unsigned long long>(tessellator.triangles));
+
+  measure(store, "glb merged", stem + ".glb", true, false, false);
+  measure(store, "glb unmerged", stem + ".glb", false, false, false);
+  measure(store, "glb merged quantized", stem + ".glb", true, true, false);
+  measure(store, "glb merged meshopt", stem + ".glb", true, true, true);
+  measure(store, "gltf merged", stem + ".gltf", true, false, false);
+
+  remove((stem + ".glb").c_str());
+  remove((stem + ".gltf").c_str());
+  delete store;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+// Measures REV export throughput on a generated model with large facet groups, which is where
+// the per-line formatting cost of exportRev shows.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include "Common.h"
+#include "Store.h"
+#include "Generator.h"
+#include "BenchCommon.h"
+
+int main(int argc, char** argv)
+{
+  size_t geometries = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  unsigned polygonsPerFacetGroup = 2 < argc ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 50;
+  unsigned iterations = 3 < argc ? static_cast<unsigned>(std::strtoul(argv[3], nullptr, 10)) : 5;
+  std::string path = 4 < argc ? argv[4] : "bench_export_rev.rev";
+
+  GeneratorOptions options;
+  options.facetPolygons = polygonsPerFacetGroup;
+  options.facetVertices = 4;
+  options.sites = generatorSitesForGeometries(options, geometries);
+  Store* store = new Store();
+  generateModel(store, benchLogger, options);
+  removeSpheres(store);
+
+  double best = 0.0;
+  uint64_t size = 0;
+  for (unsigned k = 0; k < iterations; k++) {
+    auto time0 = std::chrono::high_resolution_clock::now();
+    if (!exportRev(store, benchLogger, path.c_str())) return EXIT_FAILURE;
+    auto time1 = std::chrono::high_resolution_clock::now();
+    size = fileSize(path);
+
+    double seconds = std::chrono::duration<double>(time1 - time0).count();
+    best = std::max(best, size / (1024.0 * 1024.0 * seconds));
+  }
+  fprintf(stderr, "export_rev: %.1f MB, best of %u: %.1f MB/s\n", size / (1024.0 * 1024.0), iterations, best);
+
+  remove(path.c_str());
+  delete store;
+  return EXIT_SUCCESS;
+}
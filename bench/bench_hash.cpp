@@ -0,0 +1,68 @@
+// Compares fnv_1a and hash_bytes on inputs shaped like RVM group names and attribute values,
+// as hashed by string interning.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "Common.h"
+
+namespace {
+
+  typedef uint64_t(*HashFunc)(const char* bytes, size_t l);
+
+  // Runs over all strings a number of times and returns nanoseconds per hash.
+  double measure(HashFunc hash, const std::vector<std::string>& strings, unsigned rounds, uint64_t& sink)
+  {
+    auto time0 = std::chrono::high_resolution_clock::now();
+    for (unsigned r = 0; r < rounds; r++) {
+      for (const auto& str : strings) {
+        sink += hash(str.data(), str.size());
+      }
+    }
+    auto time1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(time1 - time0).count() / (double(rounds) * strings.size());
+  }
+
+  void run(const char* label, const std::vector<std::string>& strings, unsigned rounds)
+  {
+    size_t bytes = 0;
+    for (const auto& str : strings) bytes += str.size();
+    double averageLength = double(bytes) / strings.size();
+
+    uint64_t sink = 0;
+    double fnv = measure(fnv_1a, strings, rounds, sink);
+    double wide = measure(hash_bytes, strings, rounds, sink);
+    fprintf(stderr, "hash: %-10s avg %6.1f bytes  fnv_1a %7.2fns (%5.2f GB/s)  hash_bytes %7.2fns (%5.2f GB/s)  (%llu)\n",
+            label, averageLength, fnv, averageLength / fnv, wide, averageLength / wide, (unsigned long long)(sink & 0xF));
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  unsigned rounds = 1 < argc ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 20;
+  const size_t count = 100000;
+  char buf[256];
+
+  // Short attribute keys and values, e.g. ":Owner" or "3"
+  std::vector<std::string> strings(count);
+  for (size_t i = 0; i < count; i++) {
+    int n = snprintf(buf, sizeof(buf), ":A%zu", i % 97);
+    strings[i].assign(buf, n);
+  }
+  run("attribute", strings, rounds);
+
+  // Group names like "/SITE-A/ZONE-PIPING/PIPE-100-B-2", with longer descriptive ones mixed in
+  for (size_t i = 0; i < count; i++) {
+    int n = (i % 4) ?
+      snprintf(buf, sizeof(buf), "/SITE-%zu/ZONE-PIPING/PIPE-%zu-B-2", i % 13, i) :
+      snprintf(buf, sizeof(buf), "BRANCH %zu of PIPE /SITE-%zu/ZONE-PIPING/PIPE-%zu-B-2/B%zu", i % 5, i % 13, i, i % 3);
+    strings[i].assign(buf, n);
+  }
+  run("name", strings, rounds);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+// Microbenchmark of Map insert and lookup for 1e5 up to 1e8 keys. Keys are random 64-bit
+// values like the string hashes used by interning, and 8-byte aligned addresses like the
+// interned string pointers used as keys by Flatten and DiscardGroups.
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+
+#include "Common.h"
+
+namespace {
+
+  uint64_t splitmix64(uint64_t& state)
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  double nanosecondsPerItem(std::chrono::high_resolution_clock::time_point time0, size_t count)
+  {
+    auto time1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(time1 - time0).count() / double(count);
+  }
+
+  void run(const char* label, const std::vector<uint64_t>& keys, const std::vector<uint64_t>& missing)
+  {
+    const size_t n = keys.size();
+    double insertGrow, insertReserved, lookupHit, lookupMiss;
+    uint64_t sum = 0;
+    {
+      Map map;
+      auto time0 = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < n; i++) map.insert(keys[i], i + 1);
+      insertGrow = nanosecondsPerItem(time0, n);
+    }
+    {
+      Map map;
+      auto time0 = std::chrono::high_resolution_clock::now();
+      map.reserve(n);
+      for (size_t i = 0; i < n; i++) map.insert(keys[i], i + 1);
+      insertReserved = nanosecondsPerItem(time0, n);
+
+      time0 = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < n; i++) sum += map.get(keys[i]);
+      lookupHit = nanosecondsPerItem(time0, n);
+
+      time0 = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < n; i++) sum += map.get(missing[i]);
+      lookupMiss = nanosecondsPerItem(time0, n);
+    }
+    fprintf(stderr, "map: %-8s n=%-10zu insert %6.1fns  insert-reserved %6.1fns  hit %6.1fns  miss %6.1fns  (%llu)\n",
+            label, n, insertGrow, insertReserved, lookupHit, lookupMiss, (unsigned long long)(sum & 0xF));
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  size_t maxCount = 1 < argc ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+
+  for (size_t n = 100000; n <= maxCount; n *= 10) {
+    uint64_t state = n;
+    std::vector<uint64_t> keys(n);
+    std::vector<uint64_t> missing(n);
+
+    for (size_t i = 0; i < n; i++) {
+      keys[i] = splitmix64(state) | 1;     // odd, so never zero
+      missing[i] = splitmix64(state) & ~uint64_t(1);
+      if (missing[i] == 0) missing[i] = 2;
+    }
+    run("hash", keys, missing);
+
+    uint64_t address = 0x10000000;
+    for (size_t i = 0; i < n; i++) {
+      address += 8 * (1 + (splitmix64(state) & 7));
+      keys[i] = address;
+      missing[i] = address + 4;            // never a multiple of 8
+    }
+    run("address", keys, missing);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+// Measures REV parsing throughput on a file written by exportRev from a generated model, and
+// checks that the parsed store exports back byte for byte.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "Common.h"
+#include "Store.h"
+#include "Generator.h"
+#include "BenchCommon.h"
+#include "parserREV.h"
+
+namespace {
+
+  // The mm to m scaling of group translations on parse does not round-trip exactly.
+  void clearTranslations(Node* node)
+  {
+    if (node->kind == Node::Kind::Group) {
+      node->group.translation[0] = node->group.translation[1] = node->group.translation[2] = 0.f;
+    }
+    for (auto * child = node->children.first; child; child = child->next) {
+      clearTranslations(child);
+    }
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  size_t geometries = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : 400000;
+  unsigned iterations = 2 < argc ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 5;
+  std::string stem = 3 < argc ? argv[3] : "bench_parse_rev";
+  std::string path = stem + ".rev";
+  std::string pathAgain = stem + "-again.rev";
+
+  {
+    GeneratorOptions options;
+    options.sites = generatorSitesForGeometries(options, geometries);
+    Store* store = new Store();
+    generateModel(store, benchLogger, options);
+    removeSpheres(store);
+    clearTranslations(store->getFirstRoot());
+    if (!exportRev(store, benchLogger, path.c_str())) return EXIT_FAILURE;
+    delete store;
+  }
+
+  std::vector<char> data;
+  if (!readFile(data, path)) {
+    fprintf(stderr, "parse_rev: failed to read %s\n", path.c_str());
+    return EXIT_FAILURE;
+  }
+
+  double best = 0.0;
+  for (unsigned k = 0; k < iterations; k++) {
+    Store* store = new Store();
+    auto time0 = std::chrono::high_resolution_clock::now();
+    bool ok = parseREV(store, benchLogger, path.c_str(), data.data(), data.size());
+    auto time1 = std::chrono::high_resolution_clock::now();
+    if (!ok) {
+      fprintf(stderr, "parse_rev: parse failed: %s\n", store->errorString());
+      return EXIT_FAILURE;
+    }
+    double seconds = std::chrono::duration<double>(time1 - time0).count();
+    best = std::max(best, data.size() / (1024.0 * 1024.0 * seconds));
+
+    if (k + 1 == iterations && !exportRev(store, benchLogger, pathAgain.c_str())) return EXIT_FAILURE;
+    delete store;
+  }
+  fprintf(stderr, "parse_rev: %.1f MB, best of %u: %.1f MB/s\n", data.size() / (1024.0 * 1024.0), iterations, best);
+
+  std::vector<char> again;
+  bool identical = readFile(again, pathAgain) && again == data;
+  fprintf(stderr, "parse_rev: round trip %s\n", identical ? "identical" : "DIFFERS");
+
+  remove(path.c_str());
+  remove(pathAgain.c_str());
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,157 @@
+// Parses a synthetic RVM file larger than 4GB, where the 32-bit next chunk offsets in the chunk
+// headers wrap. The bulk of the file is group names made of zero words, which the parser skips
+// over, so the buffer is allocated with calloc and the untouched pages never become resident.
+// Groups after the 4GB mark hold a box each, whose lengths are checked after parsing.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+#include "Common.h"
+#include "Store.h"
+#include "Parser.h"
+#include "BenchCommon.h"
+
+namespace {
+
+  struct Writer
+  {
+    char* base = nullptr;
+    size_t offset = 0;
+
+    void uint32BE(uint32_t x)
+    {
+      auto * dst = reinterpret_cast<uint8_t*>(base + offset);
+      dst[0] = static_cast<uint8_t>(x >> 24);
+      dst[1] = static_cast<uint8_t>(x >> 16);
+      dst[2] = static_cast<uint8_t>(x >> 8);
+      dst[3] = static_cast<uint8_t>(x);
+      offset += 4;
+    }
+
+    void floatBE(float x)
+    {
+      uint32_t u;
+      std::memcpy(&u, &x, sizeof(u));
+      uint32BE(u);
+    }
+
+    // Empty string padded to words zero words, the buffer is already zero.
+    void emptyString(uint32_t words)
+    {
+      uint32BE(words);
+      offset += 4 * size_t(words);
+    }
+
+    void chunkHeader(const char* id, size_t payloadSize)
+    {
+      for (unsigned i = 0; i < 4; i++) uint32BE(static_cast<uint8_t>(id[i]));
+      uint64_t next = offset + 8 + payloadSize;
+      uint32BE(static_cast<uint32_t>(next));  // Wraps beyond 4GB
+      uint32BE(1);
+    }
+  };
+
+  size_t groupSize(uint32_t nameWords, bool withBox)
+  {
+    size_t size = 24 + 4 + 4 + 4 * size_t(nameWords) + 12 + 4;            // CNTB
+    if (withBox) size += 24 + 4 + 4 + 4 * 12 + 4 * 6 + 4 * 3;             // PRIM
+    size += 24 + 4;                                                        // CNTE
+    return size;
+  }
+
+  void writeGroup(Writer& w, uint32_t nameWords, bool withBox, float length)
+  {
+    w.chunkHeader("CNTB", 4 + 4 + 4 * size_t(nameWords) + 12 + 4);
+    w.uint32BE(2);  // version
+    w.emptyString(nameWords);
+    for (unsigned i = 0; i < 3; i++) w.floatBE(0.f);
+    w.uint32BE(1);  // material
+
+    if (withBox) {
+      w.chunkHeader("PRIM", 4 + 4 + 4 * 12 + 4 * 6 + 4 * 3);
+      w.uint32BE(1);  // version
+      w.uint32BE(2);  // box
+      const float M[12] = { 1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f };
+      for (float v : M) w.floatBE(v);
+      for (unsigned i = 0; i < 6; i++) w.floatBE(i < 3 ? -length : length);
+      for (unsigned i = 0; i < 3; i++) w.floatBE(length);
+    }
+
+    w.chunkHeader("CNTE", 4);
+    w.uint32BE(1);
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  size_t padding = 1 < argc ? std::strtoull(argv[1], nullptr, 10) : 4608;      // MB of group names
+  size_t boxes = 2 < argc ? std::strtoull(argv[2], nullptr, 10) : 1000;
+
+  const uint32_t nameWords = 256 * 1024 * 1024 / 4;    // 256MB per padding group
+  size_t paddingGroups = (padding * 1024 * 1024 + 4 * size_t(nameWords) - 1) / (4 * size_t(nameWords));
+
+  size_t size = 24 + 4 + 5 * 8                // HEAD with five empty strings of one word
+              + 24 + 4 + 2 * 8                // MODL with two empty strings
+              + paddingGroups * groupSize(nameWords, false)
+              + boxes * groupSize(1, true)
+              + 24 + 4;                       // END:
+
+  Writer w;
+  w.base = static_cast<char*>(std::calloc(size, 1));
+  if (w.base == nullptr) {
+    fprintf(stderr, "parse_rvm_large: failed to allocate %zu bytes\n", size);
+    return EXIT_FAILURE;
+  }
+
+  w.chunkHeader("HEAD", 4 + 5 * 8);
+  w.uint32BE(2);
+  for (unsigned i = 0; i < 5; i++) w.emptyString(1);
+  w.chunkHeader("MODL", 4 + 2 * 8);
+  w.uint32BE(1);
+  for (unsigned i = 0; i < 2; i++) w.emptyString(1);
+  for (size_t j = 0; j < paddingGroups; j++) {
+    writeGroup(w, nameWords, false, 0.f);
+  }
+  size_t boxesStart = w.offset;
+  for (size_t j = 0; j < boxes; j++) {
+    writeGroup(w, 1, true, 1.f + float(j));
+  }
+  w.chunkHeader("END:", 4);
+  w.uint32BE(1);
+  if (w.offset != size) {
+    fprintf(stderr, "parse_rvm_large: wrote %zu bytes, expected %zu\n", w.offset, size);
+    return EXIT_FAILURE;
+  }
+
+  Store* store = new Store();
+  auto time0 = std::chrono::high_resolution_clock::now();
+  bool ok = parseRVM(store, benchLogger, "synthetic.rvm", w.base, size);
+  auto time1 = std::chrono::high_resolution_clock::now();
+  if (!ok) {
+    fprintf(stderr, "parse_rvm_large: parse failed: %s\n", store->errorString());
+    return EXIT_FAILURE;
+  }
+
+  size_t errors = 0;
+  size_t j = 0;
+  Node* model = store->getFirstRoot()->children.first;
+  for (Node* group = model->children.first; group; group = group->next) {
+    Geometry* geo = group->group.geometries.first;
+    if (geo == nullptr) continue;
+    if (geo->kind != Geometry::Kind::Box || geo->box.lengths[0] != 1.f + float(j)) errors++;
+    j++;
+  }
+  if (j != boxes) errors++;
+
+  fprintf(stderr, "parse_rvm_large: %.2f GB, boxes from %.2f GB, %u groups, %u geometries in %.1fms, %s\n",
+          size / (1024.0 * 1024.0 * 1024.0), boxesStart / (1024.0 * 1024.0 * 1024.0),
+          store->groupCount_(), store->geometryCount_(),
+          std::chrono::duration<double, std::milli>(time1 - time0).count(),
+          errors ? "MISMATCH" : "ok");
+
+  delete store;
+  std::free(w.base);
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
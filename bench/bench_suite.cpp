@@ -0,0 +1,424 @@
+// Times the hot paths of a conversion on generated models of several sizes: parsing of rvm, att
+// and rev files, the triangulation kernel of each primitive kind, connect, align, flattening and
+// each exporter. Reports throughput as MB/s, primitives/s and triangles/s where they apply, and
+// optionally writes the results as JSON so runs can be compared over time.
+//
+// Usage: bench_suite [--sizes=n,n,...] [--iterations=n] [--prefix=path] [--json=file.json]
+//
+// Sizes are approximate geometry counts of the generated models. Input and output files are
+// written next to prefix and removed afterwards. Each timing is the best of the iterations.
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <algorithm>
+
+#include "Common.h"
+#include "Store.h"
+#include "LinAlgOps.h"
+#include "Parser.h"
+#include "parserREV.h"
+#include "Generator.h"
+#include "BenchCommon.h"
+#include "Tessellator.h"
+#include "Flatten.h"
+#include "Colorizer.h"
+#include "AddGroupBBox.h"
+#include "ExportObj.h"
+
+namespace {
+
+  // Only warnings and errors, and only the first few, as exportRev complains about every sphere.
+  void logger(unsigned level, const char* msg, ...)
+  {
+    static unsigned messages = 0;
+    if (level == 0) return;
+    if (20 < ++messages) {
+      if (messages == 21) fprintf(stderr, "Further messages suppressed\n");
+      return;
+    }
+    va_list argptr;
+    va_start(argptr, msg);
+    vfprintf(stderr, msg, argptr);
+    va_end(argptr);
+    fprintf(stderr, "\n");
+  }
+
+  const float tolerance = 0.1f;
+
+  const char* kindNames[] = {
+    "pyramid", "box", "rectangular-torus", "circular-torus", "elliptical-dish", "spherical-dish",
+    "snout", "cylinder", "sphere", "line", "facet-group"
+  };
+
+  struct Result
+  {
+    size_t model;         // Index into Suite::models
+    std::string name;
+    double milliseconds;
+    uint64_t bytes;
+    uint64_t primitives;
+    uint64_t triangles;
+  };
+
+  struct Model
+  {
+    unsigned groups;
+    unsigned geometries;
+    unsigned revGeometries;   // The rev format has no spheres
+    std::vector<char> rvm;
+    std::vector<char> att;
+    std::vector<char> rev;
+  };
+
+  struct Suite
+  {
+    unsigned iterations = 3;
+    std::string prefix = "bench_suite";
+    std::vector<Model> models;
+    std::vector<Result> results;
+
+    void report(const char* name, double milliseconds, uint64_t bytes, uint64_t primitives, uint64_t triangles)
+    {
+      results.push_back(Result{ models.size() - 1, name, milliseconds, bytes, primitives, triangles });
+      double seconds = 1e-3 * milliseconds;
+      fprintf(stderr, "  %-28s %10.2fms", name, milliseconds);
+      if (bytes) fprintf(stderr, " %9.1f MB/s", bytes / (1024.0 * 1024.0 * seconds));
+      if (primitives) fprintf(stderr, " %8.2f Mprim/s", 1e-6 * primitives / seconds);
+      if (triangles) fprintf(stderr, " %8.2f Mtri/s", 1e-6 * triangles / seconds);
+      fprintf(stderr, "\n");
+    }
+  };
+
+  double millisecondsSince(std::chrono::high_resolution_clock::time_point time0)
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - time0).count();
+  }
+
+  // Best time of body over the iterations. Setup and teardown run around each iteration and
+  // are not timed.
+  template<typename Setup, typename Body, typename Teardown>
+  double best(unsigned iterations, Setup setup, Body body, Teardown teardown)
+  {
+    double best = 1e30;
+    for (unsigned k = 0; k < iterations; k++) {
+      setup();
+      auto time0 = std::chrono::high_resolution_clock::now();
+      body();
+      best = std::min(best, millisecondsSince(time0));
+      teardown();
+    }
+    return best;
+  }
+
+  Store* parse(const Model& model, bool attributes)
+  {
+    Store* store = new Store();
+    if (!parseRVM(store, logger, "bench.rvm", model.rvm.data(), model.rvm.size()) ||
+        (attributes && !parseAtt(store, logger, model.att.data(), model.att.size())))
+    {
+      fprintf(stderr, "bench_suite: parse failed: %s\n", store->errorString());
+      exit(EXIT_FAILURE);
+    }
+    return store;
+  }
+
+  void collectGeometries(std::vector<const Geometry*>* byKind, Node* node)
+  {
+    if (node->kind == Node::Kind::Group) {
+      for (auto * geo = node->group.geometries.first; geo; geo = geo->next) {
+        byKind[unsigned(geo->kind)].push_back(geo);
+      }
+    }
+    for (auto * child = node->children.first; child; child = child->next) {
+      collectGeometries(byKind, child);
+    }
+  }
+
+  // Names of the groups right above the leaves, which Flatten is asked to keep.
+  void collectParentsOfLeaves(std::vector<const char*>& names, Node* node)
+  {
+    for (auto * child = node->children.first; child; child = child->next) {
+      if (child->kind == Node::Kind::Group && child->children.first && child->children.first->children.first == nullptr) {
+        names.push_back(child->group.name);
+      }
+      else {
+        collectParentsOfLeaves(names, child);
+      }
+    }
+  }
+
+  // Tiles are numbered by octree node with gaps, so look for them instead of counting.
+  void removeTiles(const std::string& stem)
+  {
+    namespace fs = std::filesystem;
+    fs::path base(stem + "_");
+    auto dir = base.parent_path().empty() ? fs::path(".") : base.parent_path();
+    auto prefix = base.filename().string();
+
+    std::error_code ec;
+    std::vector<fs::path> tiles;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+      auto name = entry.path().filename().string();
+      if (name.compare(0, prefix.size(), prefix) == 0 && entry.path().extension() == ".glb") {
+        tiles.push_back(entry.path());
+      }
+    }
+    for (const auto& path : tiles) fs::remove(path, ec);
+  }
+
+  void benchParse(Suite& suite, const Model& model)
+  {
+    Store* store = nullptr;
+    auto teardown = [&]() { delete store; store = nullptr; };
+
+    double ms = best(suite.iterations, [&]() { store = new Store(); },
+                     [&]() { parseRVM(store, logger, "bench.rvm", model.rvm.data(), model.rvm.size()); }, teardown);
+    suite.report("parse-rvm", ms, model.rvm.size(), model.geometries, 0);
+
+    ms = best(suite.iterations, [&]() { store = parse(model, false); },
+              [&]() { parseAtt(store, logger, model.att.data(), model.att.size()); }, teardown);
+    suite.report("parse-att", ms, model.att.size(), 0, 0);
+
+    ms = best(suite.iterations, [&]() { store = new Store(); },
+              [&]() { parseREV(store, logger, "bench.rev", model.rev.data(), model.rev.size()); }, teardown);
+    suite.report("parse-rev", ms, model.rev.size(), model.revGeometries, 0);
+  }
+
+  void benchKernels(Suite& suite, const Model& model)
+  {
+    Store* store = parse(model, false);
+    std::vector<const Geometry*> byKind[11];
+    collectGeometries(byKind, store->getFirstRoot());
+
+    TriangulationFactory factory(store, logger, tolerance, 3, 100);
+    Arena arena;
+    for (unsigned kind = 0; kind < 11; kind++) {
+      if (byKind[kind].empty() || Geometry::Kind(kind) == Geometry::Kind::Line) continue;
+      uint64_t triangles = 0;
+      double ms = best(suite.iterations, [&]() { arena.clear(); triangles = 0; }, [&]()
+      {
+        for (const Geometry* geo : byKind[kind]) {
+          auto * tri = factory.geometry(&arena, geo, getScale(geo->M_3x4));
+          triangles += tri->triangles_n;
+        }
+      }, []() {});
+      std::string name = std::string("tessellate-") + kindNames[kind];
+      suite.report(name.c_str(), ms, 0, byKind[kind].size(), triangles);
+    }
+    delete store;
+  }
+
+  void benchConnectAlign(Suite& suite, const Model& model)
+  {
+    Store* store = nullptr;
+    auto teardown = [&]() { delete store; store = nullptr; };
+
+    double ms = best(suite.iterations, [&]() { store = parse(model, false); },
+                     [&]() { connect(store, logger); }, teardown);
+    suite.report("connect", ms, 0, model.geometries, 0);
+
+    ms = best(suite.iterations, [&]() { store = parse(model, false); connect(store, logger); },
+              [&]() { align(store, logger); }, teardown);
+    suite.report("align", ms, 0, model.geometries, 0);
+  }
+
+  void benchFlatten(Suite& suite, const Model& model)
+  {
+    Store* store = parse(model, true);
+    std::vector<const char*> keep;
+    collectParentsOfLeaves(keep, store->getFirstRoot());
+
+    std::optional<Flatten> flatten;
+    Store* flattened = nullptr;
+    double ms = best(suite.iterations, [&]()
+    {
+      flatten.emplace(store);
+      for (const char* name : keep) flatten->keepTag(name);
+    },
+    [&]() { flattened = flatten->run(); },
+    [&]() { delete flattened; flatten.reset(); });
+    suite.report("flatten", ms, 0, model.geometries, 0);
+    delete store;
+
+    store = nullptr;
+    ms = best(suite.iterations, [&]() { store = parse(model, true); },
+              [&]() { flattenRegex(store, logger, "/SITE-[0-9]+(/[0-9]+)?"); },
+              [&]() { delete store; store = nullptr; });
+    suite.report("flatten-regex", ms, 0, model.geometries, 0);
+  }
+
+  // Exporters run on a store prepared as for a conversion with all outputs enabled.
+  void benchExport(Suite& suite, const Model& model)
+  {
+    Store* store = parse(model, true);
+    connect(store, logger);
+    align(store, logger);
+    Colorizer colorizer(logger);
+    store->apply(&colorizer);
+    AddGroupBBox addGroupBBox;
+    store->traverse(addGroupBBox);
+
+    Tessellator tessellator(logger, tolerance, -1.f, -1.f, 100);
+    auto time0 = std::chrono::high_resolution_clock::now();
+    store->traverse(tessellator);
+    suite.report("tessellate", millisecondsSince(time0), 0, tessellator.processed, tessellator.triangles);
+    uint64_t triangles = tessellator.triangles;
+
+    struct Exporter
+    {
+      const char* name;
+      std::string path;
+      bool (*run)(Store* store, const std::string& path);
+      bool usesTriangles;
+    };
+    const Exporter exporters[] = {
+      { "export-json", suite.prefix + ".json", [](Store* s, const std::string& p) { return exportJson(s, logger, p.c_str()); }, false },
+      { "export-rev", suite.prefix + ".rev", [](Store* s, const std::string& p) { return exportRev(s, logger, p.c_str()); }, false },
+      { "export-rvm", suite.prefix + "-out.rvm", [](Store* s, const std::string& p) { return exportRvm(s, logger, p.c_str()); }, false },
+      { "export-att", suite.prefix + "-out.att", [](Store* s, const std::string& p) { return exportAtt(s, logger, p.c_str()); }, false },
+      { "export-obj", suite.prefix + ".obj", [](Store* s, const std::string& p)
+        {
+          ExportObj exportObj;
+          if (!exportObj.open(p.c_str(), (p.substr(0, p.size() - 4) + ".mtl").c_str())) return false;
+          s->apply(&exportObj);
+          return true;
+        }, true },
+      { "export-gltf", suite.prefix + ".glb", [](Store* s, const std::string& p)
+        { return exportGLTF(s, logger, p.c_str(), 0, true, false, true, true, false, false, 1); }, true },
+      { "export-tiles", suite.prefix + "-tiles.json", [](Store* s, const std::string& p)
+        { return exportTiles(s, logger, p.c_str(), 100000, false, false, 1); }, true },
+    };
+    for (const auto& exporter : exporters) {
+      bool ok = true;
+      double ms = best(suite.iterations, []() {}, [&]() { ok = exporter.run(store, exporter.path) && ok; }, []() {});
+      if (!ok) {
+        fprintf(stderr, "bench_suite: %s failed\n", exporter.name);
+        continue;
+      }
+      suite.report(exporter.name, ms, fileSize(exporter.path), model.geometries, exporter.usesTriangles ? triangles : 0);
+    }
+
+    for (const auto& exporter : exporters) {
+      std::remove(exporter.path.c_str());
+    }
+    std::remove((suite.prefix + ".mtl").c_str());
+    removeTiles(suite.prefix + "-tiles");
+    delete store;
+  }
+
+  bool writeJson(const Suite& suite, const char* path)
+  {
+    FILE* out = fopen(path, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "bench_suite: Failed to open %s for writing.\n", path);
+      return false;
+    }
+    fprintf(out, "{\n  \"iterations\": %u,\n  \"models\": [\n", suite.iterations);
+    for (size_t i = 0; i < suite.models.size(); i++) {
+      const Model& model = suite.models[i];
+      fprintf(out, "    { \"groups\": %u, \"geometries\": %u, \"revGeometries\": %u, \"rvmBytes\": %zu, \"attBytes\": %zu, \"revBytes\": %zu }%s\n",
+              model.groups, model.geometries, model.revGeometries, model.rvm.size(), model.att.size(), model.rev.size(),
+              i + 1 < suite.models.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"results\": [\n");
+    for (size_t i = 0; i < suite.results.size(); i++) {
+      const Result& r = suite.results[i];
+      double seconds = 1e-3 * r.milliseconds;
+      fprintf(out, "    { \"model\": %zu, \"name\": \"%s\", \"ms\": %.3f, \"bytes\": %llu, \"primitives\": %llu, \"triangles\": %llu, "
+                   "\"MBps\": %.3f, \"primitivesPerSecond\": %.1f, \"trianglesPerSecond\": %.1f }%s\n",
+              r.model, r.name.c_str(), r.milliseconds,
+              (unsigned long long)r.bytes, (unsigned long long)r.primitives, (unsigned long long)r.triangles,
+              r.bytes / (1024.0 * 1024.0 * seconds), r.primitives / seconds, r.triangles / seconds,
+              i + 1 < suite.results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    bool writeError = ferror(out) != 0;
+    if (fclose(out) != 0 || writeError) {
+      fprintf(stderr, "bench_suite: Failed to write %s.\n", path);
+      return false;
+    }
+    return true;
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  Suite suite;
+  std::vector<size_t> sizes = { 20000, 200000 };
+  std::string json;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto e = arg.find('=');
+    auto key = arg.substr(0, e);
+    auto val = e == std::string::npos ? std::string() : arg.substr(e + 1);
+    if (key == "--sizes") {
+      sizes.clear();
+      for (size_t a = 0; a < val.size(); ) {
+        auto b = std::min(val.find(',', a), val.size());
+        sizes.push_back(std::strtoull(val.substr(a, b - a).c_str(), nullptr, 10));
+        a = b + 1;
+      }
+    }
+    else if (key == "--iterations") suite.iterations = std::max(1u, unsigned(std::strtoul(val.c_str(), nullptr, 10)));
+    else if (key == "--prefix") suite.prefix = val;
+    else if (key == "--json") json = val;
+    else {
+      fprintf(stderr, "Usage: bench_suite [--sizes=n,n,...] [--iterations=n] [--prefix=path] [--json=file.json]\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (size_t size : sizes) {
+    GeneratorOptions options;
+    options.sites = generatorSitesForGeometries(options, size);
+
+    Model model;
+    {
+      Store* store = new Store();
+      generateModel(store, logger, options);
+      model.groups = store->groupCount_();
+      model.geometries = store->geometryCount_();
+      bool ok = exportRvm(store, logger, (suite.prefix + ".rvm").c_str()) &&
+                exportAtt(store, logger, (suite.prefix + ".att").c_str());
+      removeSpheres(store);
+      model.revGeometries = store->geometryCount_();
+      ok = ok && exportRev(store, logger, (suite.prefix + ".rev").c_str()) &&
+                readFile(model.rvm, suite.prefix + ".rvm") &&
+                readFile(model.att, suite.prefix + ".att") &&
+                readFile(model.rev, suite.prefix + ".rev");
+      std::remove((suite.prefix + ".rvm").c_str());
+      std::remove((suite.prefix + ".att").c_str());
+      std::remove((suite.prefix + ".rev").c_str());
+      delete store;
+      if (!ok) {
+        fprintf(stderr, "bench_suite: Failed to write model files with prefix %s\n", suite.prefix.c_str());
+        return EXIT_FAILURE;
+      }
+    }
+    fprintf(stderr, "bench_suite: %u groups, %u geometries, rvm %.1fMB, att %.1fMB, rev %.1fMB\n",
+            model.groups, model.geometries, model.rvm.size() / (1024.0 * 1024.0),
+            model.att.size() / (1024.0 * 1024.0), model.rev.size() / (1024.0 * 1024.0));
+    suite.models.push_back(std::move(model));
+
+    const Model& current = suite.models.back();
+    benchParse(suite, current);
+    benchKernels(suite, current);
+    benchConnectAlign(suite, current);
+    benchFlatten(suite, current);
+    benchExport(suite, current);
+  }
+
+  if (!json.empty() && !writeJson(suite, json.c_str())) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,71 @@
+// Compares the virtual Store::apply with the statically dispatched Store::traverse for the
+// visitors that run over every geometry of a model: AddGroupBBox, AddStats and Tessellator.
+// The store is made by generateModel, a hierarchy of groups holding a mix of primitive kinds.
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+
+#include "Common.h"
+#include "Store.h"
+#include "Generator.h"
+#include "BenchCommon.h"
+#include "AddGroupBBox.h"
+#include "AddStats.h"
+#include "Tessellator.h"
+
+namespace {
+
+  template<typename Visitor, typename MakeVisitor>
+  void run(Store* store, const char* label, unsigned iterations, MakeVisitor makeVisitor)
+  {
+    double bestApply = 1e30;
+    double bestTraverse = 1e30;
+    for (unsigned k = 0; k < iterations; k++) {
+      {
+        Visitor visitor = makeVisitor();
+        auto time0 = std::chrono::high_resolution_clock::now();
+        store->apply(&visitor);
+        auto time1 = std::chrono::high_resolution_clock::now();
+        bestApply = std::min(bestApply, std::chrono::duration<double, std::milli>(time1 - time0).count());
+      }
+      {
+        Visitor visitor = makeVisitor();
+        auto time0 = std::chrono::high_resolution_clock::now();
+        store->traverse(visitor);
+        auto time1 = std::chrono::high_resolution_clock::now();
+        bestTraverse = std::min(bestTraverse, std::chrono::duration<double, std::milli>(time1 - time0).count());
+      }
+    }
+    double perGeometry = 1e6 / store->geometryCount_();
+    fprintf(stderr, "traverse: %-13s apply %8.1fms (%5.1fns/geo)  traverse %8.1fms (%5.1fns/geo)  %.2fx\n",
+            label, bestApply, bestApply * perGeometry, bestTraverse, bestTraverse * perGeometry, bestApply / bestTraverse);
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  size_t geometries = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+  unsigned iterations = 2 < argc ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 5;
+  size_t tessellateGeometries = 3 < argc ? std::strtoul(argv[3], nullptr, 10) : 1000000;
+
+  GeneratorOptions options;
+  options.sites = generatorSitesForGeometries(options, geometries);
+  Store* store = new Store();
+  generateModel(store, benchLogger, options);
+  fprintf(stderr, "traverse: %u groups, %u geometries\n", store->groupCount_(), store->geometryCount_());
+
+  run<AddGroupBBox>(store, "AddGroupBBox", iterations, []() { return AddGroupBBox(); });
+  run<AddStats>(store, "AddStats", iterations, []() { return AddStats(); });
+  delete store;
+
+  // Tessellation does far more work per geometry, use a smaller model.
+  options.sites = generatorSitesForGeometries(options, tessellateGeometries);
+  store = new Store();
+  generateModel(store, benchLogger, options);
+  run<Tessellator>(store, "Tessellator", iterations, []() { return Tessellator(benchLogger, 0.1f, -1.f, -1.f, 100); });
+  delete store;
+
+  return EXIT_SUCCESS;
+}
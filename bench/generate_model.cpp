@@ -0,0 +1,91 @@
+// Writes a synthetic model made by generateModel as a matching pair of .rvm and .att files, for
+// benchmarking and testing at sizes where real models are not at hand.
+//
+// Usage: generate_model [--key=value ...] stem
+//
+// Keys are the fields of GeneratorOptions: seed, sites, depth, width, primitives-per-leaf,
+// facet-polygons, facet-vertices, repeat-rate, pipe-rate, pipe-segments and attributes. In
+// addition, --geometries=n sets the number of sites so the model holds about n geometries.
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <string>
+
+#include "Common.h"
+#include "Store.h"
+#include "Generator.h"
+
+namespace {
+
+  void logger(unsigned level, const char* msg, ...)
+  {
+    switch (level) {
+    case 0: fprintf(stderr, "[I] "); break;
+    case 1: fprintf(stderr, "[W] "); break;
+    default: fprintf(stderr, "[E] "); break;
+    }
+    va_list argptr;
+    va_start(argptr, msg);
+    vfprintf(stderr, msg, argptr);
+    va_end(argptr);
+    fprintf(stderr, "\n");
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  GeneratorOptions options;
+  size_t geometries = 0;
+  std::string stem;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.substr(0, 2) != "--") {
+      stem = arg;
+      continue;
+    }
+    auto e = arg.find('=');
+    if (e == std::string::npos) {
+      fprintf(stderr, "generate_model: Expected --key=value, got '%s'\n", arg.c_str());
+      return EXIT_FAILURE;
+    }
+    auto key = arg.substr(0, e);
+    auto val = arg.substr(e + 1);
+    unsigned u = static_cast<unsigned>(std::strtoul(val.c_str(), nullptr, 10));
+    float f = std::strtof(val.c_str(), nullptr);
+
+    if (key == "--seed") options.seed = u;
+    else if (key == "--sites") options.sites = u;
+    else if (key == "--depth") options.depth = u;
+    else if (key == "--width") options.width = u;
+    else if (key == "--primitives-per-leaf") options.primitivesPerLeaf = u;
+    else if (key == "--facet-polygons") options.facetPolygons = u;
+    else if (key == "--facet-vertices") options.facetVertices = u;
+    else if (key == "--repeat-rate") options.repeatRate = f;
+    else if (key == "--pipe-rate") options.pipeRate = f;
+    else if (key == "--pipe-segments") options.pipeSegments = u;
+    else if (key == "--attributes") options.attributesPerGroup = u;
+    else if (key == "--geometries") geometries = std::strtoull(val.c_str(), nullptr, 10);
+    else {
+      fprintf(stderr, "generate_model: Unrecognized option '%s'\n", key.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+  if (stem.empty()) {
+    fprintf(stderr, "Usage: generate_model [--key=value ...] stem\n");
+    return EXIT_FAILURE;
+  }
+
+  if (geometries) {
+    options.sites = generatorSitesForGeometries(options, geometries);
+  }
+
+  Store* store = new Store();
+  generateModel(store, logger, options);
+
+  bool ok = exportRvm(store, logger, (stem + ".rvm").c_str()) &&
+            exportAtt(store, logger, (stem + ".att").c_str());
+  delete store;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -36,3 +36,5 @@ void AddGroupBBox::EndGroup()
     engulf(parentBox, bbox);
   }
 }
+
+template void Store::traverse<AddGroupBBox>(AddGroupBBox& visitor);
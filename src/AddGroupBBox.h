@@ -2,6 +2,7 @@
 
 #include "Common.h"
 #include "StoreVisitor.h"
+#include "Store.h"
 
 class AddGroupBBox : public StoreVisitor
 {
@@ -21,4 +22,7 @@ protected:
   Node** stack = nullptr;
   unsigned stack_p = 0;
 
-};
\ No newline at end of file
+};
+
+// Instantiated in AddGroupBBox.cpp where the hooks can be inlined.
+extern template void Store::traverse<AddGroupBBox>(AddGroupBBox& visitor);
@@ -59,3 +59,5 @@ bool AddStats::done()
 {
   return true;
 }
+
+template void Store::traverse<AddStats>(AddStats& visitor);
@@ -1,5 +1,6 @@
 #pragma once
 #include "StoreVisitor.h"
+#include "Store.h"
 
 struct Stats
 {
@@ -40,4 +41,7 @@ public:
 private:
   struct Stats* stats = nullptr;
 
-};
\ No newline at end of file
+};
+
+// Instantiated in AddStats.cpp where the hooks can be inlined.
+extern template void Store::traverse<AddStats>(AddStats& visitor);
@@ -1,6 +1,7 @@
 #include <cassert>
 #include <chrono>
 #include "Store.h"
+#include "Instrumentation.h"
 #include "LinAlgOps.h"
 
 namespace {
@@ -90,21 +91,21 @@ namespace {
       auto b1 = a1 + 1.5f*ct.radius*upNewWorld[1];
 
       //if (context.front == 1) {
-      //  if (geo->connections[0]) context.store->addDebugLine(a0.data, b0.data, 0x00ffff);
-      //  if (geo->connections[1]) context.store->addDebugLine(a1.data, b1.data, 0x00ff88);
+      //  if (geo->connection(0)) context.store->addDebugLine(a0.data, b0.data, 0x00ffff);
+      //  if (geo->connection(1)) context.store->addDebugLine(a1.data, b1.data, 0x00ff88);
       //}
       //else if (offset == 0) {
-      //  if (geo->connections[0]) context.store->addDebugLine(a0.data, b0.data, 0x0000ff);
-      //  if (geo->connections[1]) context.store->addDebugLine(a1.data, b1.data, 0x000088);
+      //  if (geo->connection(0)) context.store->addDebugLine(a0.data, b0.data, 0x0000ff);
+      //  if (geo->connection(1)) context.store->addDebugLine(a1.data, b1.data, 0x000088);
       //}
       //else {
-      //  if (geo->connections[0]) context.store->addDebugLine(a0.data, b0.data, 0x000088);
-      //  if (geo->connections[1]) context.store->addDebugLine(a1.data, b1.data, 0x0000ff);
+      //  if (geo->connection(0)) context.store->addDebugLine(a0.data, b0.data, 0x000088);
+      //  if (geo->connection(1)) context.store->addDebugLine(a1.data, b1.data, 0x0000ff);
       //}
     }
 
     for (unsigned k = 0; k < 2; k++) {
-      auto * con = geo->connections[k];
+      auto * con = geo->connection(k);
       if (con && !con->hasFlag(Connection::Flags::HasRectangularSide) && con->temp == 0) {
         enqueue(context, geo, con, upNewWorld[k]);
       }
@@ -133,7 +134,7 @@ namespace {
                                                                  0.f));
 
     for (unsigned k = 0; k < 2; k++) {
-      auto * con = geo->connections[k];
+      auto * con = geo->connection(k);
       if (con && !con->hasFlag(Connection::Flags::HasRectangularSide) && con->temp == 0) {
         enqueue(context, geo, con, upNewWorld);
       }
@@ -179,7 +180,7 @@ namespace {
 
 }
 
-void align(Store* store, Logger logger)
+void align(Store* store, Logger logger, Instrumentation* instrumentation)
 {
   Context context;
   context.logger = logger;
@@ -225,4 +226,9 @@ void align(Store* store, Logger logger)
   auto e0 = std::chrono::duration_cast<std::chrono::milliseconds>((time1 - time0)).count();
 
   logger(0, "%d connected components in %d circular connections (%lldms).", context.connectedComponents, context.circularConnections, e0);
+  if (instrumentation) {
+    instrumentation->addCounter("align", "connections", context.connections);
+    instrumentation->addCounter("align", "circularConnections", context.circularConnections);
+    instrumentation->addCounter("align", "connectedComponents", context.connectedComponents);
+  }
 }
\ No newline at end of file
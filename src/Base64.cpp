@@ -0,0 +1,98 @@
+#include <array>
+#include <cassert>
+#include <cstring>
+
+// MSVC does not define __SSSE3__, but implies it with /arch:AVX and up
+#if defined(__SSSE3__) || defined(__AVX__)
+#define RVMPARSER_BASE64_SSSE3 (1)
+#include <tmmintrin.h>
+#else
+#define RVMPARSER_BASE64_SSSE3 (0)
+#endif
+
+#include "Base64.h"
+
+namespace {
+
+  // Base64 table from RFC4648
+  const char rfc4648[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  static_assert(sizeof(rfc4648) == 65);
+
+  // Pairs of output characters for every 12-bit input value, so three bytes become
+  // four characters using two lookups.
+  constexpr std::array<char, 2 * 4096> pairTable = []()
+  {
+    std::array<char, 2 * 4096> table{};
+    for (size_t i = 0; i < 4096; i++) {
+      table[2 * i + 0] = rfc4648[i >> 6];
+      table[2 * i + 1] = rfc4648[i & 0x3f];
+    }
+    return table;
+  }();
+
+#if RVMPARSER_BASE64_SSSE3
+
+  // Encodes 12 bytes into 16 characters at a time, see Wojciech Mula and Daniel Lemire,
+  // "Faster Base64 Encoding and Decoding Using AVX2 Instructions", 2018. Returns the number
+  // of input bytes consumed, which is a multiple of three.
+  size_t encodeSSSE3(char* dst, const uint8_t* data, size_t byteLength)
+  {
+    size_t i = 0;
+    for (; i + 16 <= byteLength; i += 12) {
+      __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+
+      // Spread each triplet over 32 bits and split into four 6-bit indices
+      in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+      const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+      const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+      const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+      const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+      const __m128i indices = _mm_or_si128(t1, t3);
+
+      // Map index ranges [0,26), [26,52), [52,62), 62 and 63 to an offset into ASCII
+      __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+      const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+      range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+      const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                            '/' - 63, 'A', 0, 0);
+      const __m128i result = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * (i / 3)), result);
+    }
+    return i;
+  }
+
+#endif
+
+}
+
+void base64Encode(char* dst, const uint8_t* data, size_t byteLength)
+{
+  size_t i = 0;
+#if RVMPARSER_BASE64_SSSE3
+  i = encodeSSSE3(dst, data, byteLength);
+#endif
+  char* o = dst + 4 * (i / 3);
+
+  // Handle range that is a multiple of three
+  for (; i + 3 <= byteLength; i += 3) {
+    const uint32_t d = (uint32_t(data[i + 0]) << 16) | (uint32_t(data[i + 1]) << 8) | uint32_t(data[i + 2]);
+    std::memcpy(o + 0, pairTable.data() + 2 * (d >> 12), 2);
+    std::memcpy(o + 2, pairTable.data() + 2 * (d & 0xfff), 2);
+    o += 4;
+  }
+
+  // Handle end if byteLength is not a multiple of three
+  if (i < byteLength) {
+    const bool two = (i + 1 < byteLength);  // one or two extra bytes (three would go into loop above)?
+    const uint8_t d0 = data[i + 0];
+    const uint8_t d1 = two ? data[i + 1] : 0;
+    o[0] = rfc4648[(d0 >> 2)];
+    o[1] = rfc4648[((d0 << 4) & 0x30) | (d1 >> 4)];
+    o[2] = two ? rfc4648[((d1 << 2) & 0x3c)] : '=';
+    o[3] = '=';
+    o += 4;
+  }
+  assert(o == dst + base64EncodedLength(byteLength));
+}
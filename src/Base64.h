@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Number of characters in the padded base64 encoding of byteLength bytes
+inline size_t base64EncodedLength(size_t byteLength) { return 4 * ((byteLength + 2) / 3); }
+
+// Encodes data using the RFC4648 alphabet with padding. The destination must hold
+// base64EncodedLength(byteLength) characters. Long inputs can be encoded in chunks as
+// long as all but the last chunk have a length that is a multiple of three.
+void base64Encode(char* dst, const uint8_t* data, size_t byteLength);
@@ -2,8 +2,26 @@
 #include <cstdlib>
 #include <cstdio>
 #include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cstring>
+#include <mutex>
+
+// SSE2 is part of x86-64, MSVC only says so through _M_X64 or _M_IX86_FP
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#define RVMPARSER_MAP_SSE2 (1)
+#include <emmintrin.h>
+#else
+#define RVMPARSER_MAP_SSE2 (0)
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>   // _umul128
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 namespace {
 
@@ -21,6 +39,132 @@ namespace {
     return x;
   }
 
+  constexpr size_t mapGroupWidth = 16;
+  constexpr uint8_t mapEmpty = 0x80;
+
+  // Bit i is set if control byte i of the group starting at ctrl equals value.
+  unsigned matchGroup(const uint8_t* ctrl, uint8_t value)
+  {
+#if RVMPARSER_MAP_SSE2
+    __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(static_cast<char>(value)))));
+#else
+    unsigned mask = 0;
+    for (unsigned i = 0; i < mapGroupWidth; i++) {
+      mask |= (ctrl[i] == value ? 1u : 0u) << i;
+    }
+    return mask;
+#endif
+  }
+
+  unsigned lowestBit(unsigned mask)
+  {
+    assert(mask);
+    return static_cast<unsigned>(std::countr_zero(mask));
+  }
+
+  // The low 7 bits of the hash go into the control byte, the rest selects the start slot.
+  uint8_t controlByte(uint64_t hash)
+  {
+    return static_cast<uint8_t>(hash & 0x7F);
+  }
+
+  struct ArenaPageHeader
+  {
+    uint8_t* next;
+    size_t size;
+    bool mapped;
+  };
+  constexpr size_t arenaPageHeaderSize = (sizeof(ArenaPageHeader) + 7) & ~size_t(7);
+
+  uint8_t* allocatePage(size_t& pageBytes, size_t bytes, bool hugePages)
+  {
+    uint8_t* page = nullptr;
+    bool mapped = false;
+    pageBytes = bytes;
+#ifdef __linux__
+    if (hugePages) {
+      const size_t hugePageSize = 2 * 1024 * 1024;
+      size_t rounded = (bytes + hugePageSize - 1) & ~(hugePageSize - 1);
+      void* ptr = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (ptr == MAP_FAILED) {
+        // No reserved huge pages, ask for transparent huge pages instead.
+        ptr = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr != MAP_FAILED) madvise(ptr, rounded, MADV_HUGEPAGE);
+      }
+      if (ptr != MAP_FAILED) {
+        page = (uint8_t*)ptr;
+        pageBytes = rounded;
+        mapped = true;
+      }
+    }
+#else
+    (void)hugePages;
+#endif
+    if (page == nullptr) {
+      page = (uint8_t*)xmalloc(bytes);
+    }
+    auto * header = (ArenaPageHeader*)page;
+    header->next = nullptr;
+    header->size = pageBytes;
+    header->mapped = mapped;
+    return page;
+  }
+
+  void freePage(uint8_t* page)
+  {
+    auto * header = (ArenaPageHeader*)page;
+#ifdef __linux__
+    if (header->mapped) {
+      munmap(page, header->size);
+      return;
+    }
+#endif
+    assert(!header->mapped);
+    free(page);
+  }
+
+  uint64_t read64(const char* p)
+  {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  uint64_t read32(const char* p)
+  {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  // 64 x 64 -> 128 bit multiply, low half into a and high half into b.
+  void mum(uint64_t& a, uint64_t& b)
+  {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    a = _umul128(a, b, &b);
+#else
+    uint64_t ha = a >> 32, la = uint32_t(a), hb = b >> 32, lb = uint32_t(b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    a = lo;
+    b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+  }
+
+  uint64_t mix(uint64_t a, uint64_t b)
+  {
+    mum(a, b);
+    return a ^ b;
+  }
+
 }
 
 uint64_t fnv_1a(const char* bytes, size_t l)
@@ -33,6 +177,59 @@ uint64_t fnv_1a(const char* bytes, size_t l)
   return hash;
 }
 
+uint64_t hash_bytes(const char* bytes, size_t l)
+{
+  const uint64_t p0 = 0xa0761d6478bd642full;
+  const uint64_t p1 = 0xe7037ed1a0b428dbull;
+  const uint64_t p2 = 0x8ebc6af09c88c6dbull;
+  const uint64_t p3 = 0x589965cc75374cc3ull;
+
+  uint64_t seed = mix(p0, p1);
+  uint64_t a, b;
+  if (l <= 16) {
+    if (4 <= l) {
+      size_t o = (l >> 3) << 2;  // 0 or 4, the two halves overlap for lengths below 8
+      a = (read32(bytes) << 32) | read32(bytes + o);
+      b = (read32(bytes + l - 4) << 32) | read32(bytes + l - 4 - o);
+    }
+    else if (0 < l) {
+      a = (uint64_t(uint8_t(bytes[0])) << 16) | (uint64_t(uint8_t(bytes[l >> 1])) << 8) | uint64_t(uint8_t(bytes[l - 1]));
+      b = 0;
+    }
+    else {
+      a = b = 0;
+    }
+  }
+  else {
+    const char* p = bytes;
+    size_t i = l;
+    if (48 < i) {
+      // Three independent lanes to hide the multiply latency on long inputs
+      uint64_t seed1 = seed;
+      uint64_t seed2 = seed;
+      do {
+        seed = mix(read64(p) ^ p1, read64(p + 8) ^ seed);
+        seed1 = mix(read64(p + 16) ^ p2, read64(p + 24) ^ seed1);
+        seed2 = mix(read64(p + 32) ^ p3, read64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (48 < i);
+      seed ^= seed1 ^ seed2;
+    }
+    while (16 < i) {
+      seed = mix(read64(p) ^ p1, read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = read64(p + i - 16);   // The last 16 bytes, may overlap what was consumed above
+    b = read64(p + i - 8);
+  }
+  a ^= p1;
+  b ^= seed;
+  mum(a, b);
+  return mix(a ^ p0 ^ l, b ^ p1);
+}
+
 
 void* xmalloc(size_t size)
 {
@@ -67,34 +264,55 @@ void BufferBase::free()
   if (ptr) ::free(ptr - sizeof(size_t));
 }
 
-void* Arena::alloc(size_t bytes)
+void ArenaStats::add(const ArenaStats& other)
 {
-  const size_t pageSize = 1024 * 1024;
+  bytesRequested += other.bytesRequested;
+  bytesReserved += other.bytesReserved;
+  pages += other.pages;
+  bytesWasted += other.bytesWasted;
+  hugePages += other.hugePages;
+}
 
+void* Arena::alloc(size_t bytes)
+{
   if (bytes == 0) return nullptr;
 
   auto padded = (bytes + 7) & ~7;
+  stats.bytesRequested += bytes;
 
   if (size < fill + padded) {
-    fill = sizeof(uint8_t*);
-    size = std::max(pageSize, fill + padded);
-
-    auto * page = (uint8_t*)xmalloc(size);
-    *(uint8_t**)page = nullptr;
-
-    if (first == nullptr) {
+    if (pageSize / 4 < padded || pageSize < arenaPageHeaderSize + padded) {
+      // Large allocation, give it a page of its own and keep filling the current one.
+      size_t pageBytes = 0;
+      auto * page = allocatePage(pageBytes, arenaPageHeaderSize + padded, hugePages);
+      ((ArenaPageHeader*)page)->next = first;
       first = page;
-      curr = page;
-    }
-    else {
-      *(uint8_t**)curr = page; // update next
-      curr = page;
+      if (curr == nullptr) {  // Nothing to keep filling, continue after this allocation
+        curr = page;
+        fill = arenaPageHeaderSize + padded;
+        size = pageBytes;
+      }
+      stats.bytesReserved += pageBytes;
+      stats.pages++;
+      if (((ArenaPageHeader*)page)->mapped) stats.hugePages++;
+      return page + arenaPageHeaderSize;
     }
+
+    if (curr) stats.bytesWasted += size - fill;
+    size_t pageBytes = 0;
+    auto * page = allocatePage(pageBytes, pageSize, hugePages);
+    ((ArenaPageHeader*)page)->next = first;
+    first = page;
+    curr = page;
+    fill = arenaPageHeaderSize;
+    size = pageBytes;
+    stats.bytesReserved += pageBytes;
+    stats.pages++;
+    if (((ArenaPageHeader*)page)->mapped) stats.hugePages++;
   }
 
   assert(first != nullptr);
   assert(curr != nullptr);
-  assert(*(uint8_t**)curr == nullptr);
   assert(fill + padded <= size);
 
   auto * rv = curr + fill;
@@ -110,48 +328,126 @@ void* Arena::dup(const void* src, size_t bytes)
 }
 
 
+void Arena::adopt(Arena& other)
+{
+  if (other.first == nullptr) return;
+
+  // Pages are linked from newest to oldest, link the oldest of other to our newest.
+  auto * last = other.first;
+  while (((ArenaPageHeader*)last)->next) last = ((ArenaPageHeader*)last)->next;
+  ((ArenaPageHeader*)last)->next = first;
+  first = other.first;
+  if (curr == nullptr) {
+    curr = other.curr;
+    fill = other.fill;
+    size = other.size;
+  }
+  stats.add(other.stats);
+
+  other.first = nullptr;
+  other.curr = nullptr;
+  other.fill = 0;
+  other.size = 0;
+  other.stats = ArenaStats();
+}
+
+void Arena::rewind(const Mark& mark)
+{
+  while (first != mark.first) {
+    assert(first != nullptr && "Mark is not from this arena");
+    auto * next = ((ArenaPageHeader*)first)->next;
+    freePage(first);
+    first = next;
+  }
+  curr = mark.curr;
+  fill = mark.fill;
+  size = mark.size;
+  stats = mark.stats;
+}
+
 void Arena::clear()
 {
   auto * c = first;
   while (c != nullptr) {
-    auto * n = *(uint8_t**)c;
-    free(c);
+    auto * n = ((ArenaPageHeader*)c)->next;
+    freePage(c);
     c = n;
   }
   first = nullptr;
   curr = nullptr;
   fill = 0;
   size = 0;
+  stats = ArenaStats();
 }
 
 Map::~Map()
 {
-  free(keys);
-  free(vals);
+  free(ctrl);
+  free(slots);
 }
 
 void Map::clear()
 {
-  for (unsigned i = 0; i < capacity; i++) {
-    keys[i] = 0;
-    vals[i] = 0;
-  }
+  if (ctrl) std::memset(ctrl, mapEmpty, capacity + mapGroupWidth);
   fill = 0;
 }
 
+void Map::reserve(size_t count)
+{
+  size_t newCapacity = capacity ? capacity : 16;
+  while (newCapacity - newCapacity / 8 < count) newCapacity *= 2;  // Max load factor is 7/8
+  if (capacity < newCapacity) rehash(newCapacity);
+}
+
+void Map::rehash(size_t newCapacity)
+{
+  assert(isPow2(newCapacity) && mapGroupWidth <= newCapacity);
+  auto * oldCtrl = ctrl;
+  auto * oldSlots = slots;
+  auto oldCapacity = capacity;
+
+  capacity = newCapacity;
+  ctrl = (uint8_t*)xmalloc(capacity + mapGroupWidth);
+  slots = (Slot*)xmalloc(capacity * sizeof(Slot));
+  std::memset(ctrl, mapEmpty, capacity + mapGroupWidth);
+
+  // Keys are unique, so just place each in the first empty slot of its probe sequence.
+  auto mask = capacity - 1;
+  for (size_t j = 0; j < oldCapacity; j++) {
+    if (oldCtrl[j] == mapEmpty) continue;
+    auto hash = hash_uint64(oldSlots[j].key);
+    for (auto pos = size_t(hash >> 7) & mask; true; pos = (pos + mapGroupWidth) & mask) {
+      unsigned empty = matchGroup(ctrl + pos, mapEmpty);
+      if (empty) {
+        auto i = (pos + lowestBit(empty)) & mask;
+        ctrl[i] = controlByte(hash);
+        if (i < mapGroupWidth) ctrl[capacity + i] = ctrl[i];
+        slots[i] = oldSlots[j];
+        break;
+      }
+    }
+  }
+
+  free(oldCtrl);
+  free(oldSlots);
+}
+
 bool Map::get(uint64_t& val, uint64_t key)
 {
   assert(key != 0);
   if (fill == 0) return false;
 
+  auto hash = hash_uint64(key);
   auto mask = capacity - 1;
-  for (auto i = size_t(hash_uint64(key)); true ; i++) { // linear probing
-    i = i & mask;
-    if (keys[i] == key) {
-      val = vals[i];
-      return true;
+  for (auto pos = size_t(hash >> 7) & mask; true; pos = (pos + mapGroupWidth) & mask) { // group-wise linear probing
+    for (unsigned match = matchGroup(ctrl + pos, controlByte(hash)); match; match &= match - 1) {
+      auto i = (pos + lowestBit(match)) & mask;
+      if (slots[i].key == key) {
+        val = slots[i].val;
+        return true;
+      }
     }
-    else if (keys[i] == 0) {
+    if (matchGroup(ctrl + pos, mapEmpty)) {
       return false;
     }
   }
@@ -170,44 +466,30 @@ void Map::insert(uint64_t key, uint64_t value)
   assert(key != 0);     // null is used to denote no-key
   //assert(value != 0);   // null value is used to denote not found
 
-  if (capacity <= 2 * fill) {
-    auto old_capacity = capacity;
-    auto old_keys = keys;
-    auto old_vals = vals;
-
-    fill = 0;
-    capacity = capacity ? 2 * capacity : 16;
-    keys = (uint64_t*)xcalloc(capacity, sizeof(uint64_t));
-    vals = (uint64_t*)xmalloc(capacity * sizeof(uint64_t));
-
-    unsigned g = 0;
-    for (size_t i = 0; i < old_capacity; i++) {
-      if (old_keys[i]) {
-        insert(old_keys[i], old_vals[i]);
-        g++;
-      }
-    }
-
-    free(old_keys);
-    free(old_vals);
+  if (capacity - capacity / 8 <= fill) {
+    rehash(capacity ? 2 * capacity : 16);
   }
 
-  assert(isPow2(capacity));
+  auto hash = hash_uint64(key);
   auto mask = capacity - 1;
-  for (auto i = size_t(hash_uint64(key)); true; i++) { // linear probing
-    i = i & mask;
-    if (keys[i] == key) {
-      vals[i] = value;
-      break;
-    }
-    else if (keys[i] == 0) {
-      keys[i] = key;
-      vals[i] = value;
+  for (auto pos = size_t(hash >> 7) & mask; true; pos = (pos + mapGroupWidth) & mask) {
+    for (unsigned match = matchGroup(ctrl + pos, controlByte(hash)); match; match &= match - 1) {
+      auto i = (pos + lowestBit(match)) & mask;
+      if (slots[i].key == key) {
+        slots[i].val = value;
+        return;
+      }
+    }
+    unsigned empty = matchGroup(ctrl + pos, mapEmpty);
+    if (empty) {
+      auto i = (pos + lowestBit(empty)) & mask;
+      ctrl[i] = controlByte(hash);
+      if (i < mapGroupWidth) ctrl[capacity + i] = ctrl[i];
+      slots[i] = Slot{ key, value };
       fill++;
-      break;
+      return;
     }
   }
-
 }
 
 namespace {
@@ -219,6 +501,40 @@ namespace {
     char string[1];
   };
 
+  constexpr unsigned stringInterningShardBits = 4;
+  constexpr unsigned stringInterningShards = 1u << stringInterningShardBits;
+
+}
+
+struct alignas(64) StringInterning::Shard
+{
+  std::mutex mutex;
+  Arena arena;
+  Map map;
+};
+
+StringInterning::StringInterning() :
+  shards(new Shard[stringInterningShards])
+{
+  // Names are short and spread over all shards, full-sized pages would mostly sit empty.
+  for (unsigned i = 0; i < stringInterningShards; i++) {
+    shards[i].arena.pageSize = 64 * 1024;
+  }
+}
+
+StringInterning::~StringInterning()
+{
+  delete[] shards;
+}
+
+ArenaStats StringInterning::stats()
+{
+  ArenaStats rv;
+  for (unsigned i = 0; i < stringInterningShards; i++) {
+    std::lock_guard<std::mutex> lock(shards[i].mutex);
+    rv.add(shards[i].arena.stats);
+  }
+  return rv;
 }
 
 const char* StringInterning::intern(const char* str)
@@ -230,10 +546,14 @@ const char* StringInterning::intern(const char* a, const char* b)
 {
   assert(a <= b);
   const size_t length = b - a;
-  uint64_t hash = fnv_1a(a, length);
+  uint64_t hash = hash_bytes(a, length);
   hash = hash ? hash : 1;
 
-  auto * intern = (StringHeader*)map.get(hash);
+  // Top bits select the shard, the map hashes the full value again.
+  Shard& shard = shards[hash >> (64 - stringInterningShardBits)];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  auto * intern = (StringHeader*)shard.map.get(hash);
   for (auto * it = intern; it != nullptr; it = it->next) {
     if (it->length == length) {
       if (strncmp(it->string, a, length) == 0) {
@@ -242,11 +562,11 @@ const char* StringInterning::intern(const char* a, const char* b)
     }
   }
 
-  auto * newIntern = (StringHeader*)arena.alloc(sizeof(StringHeader) + length);
+  auto * newIntern = (StringHeader*)shard.arena.alloc(sizeof(StringHeader) + length);
   newIntern->next = intern;
   newIntern->length = length;
   std::memcpy(newIntern->string, a, length);
   newIntern->string[length] = '\0';
-  map.insert(hash, uint64_t(newIntern));
+  shard.map.insert(hash, uint64_t(newIntern));
   return newIntern->string;
 }
@@ -6,6 +6,8 @@ class Store;
 
 struct Triangulation;
 
+struct Instrumentation;
+
 typedef void(*Logger)(unsigned level, const char* msg, ...);
 
 void* xmalloc(size_t size);
@@ -16,6 +18,21 @@ void* xrealloc(void* ptr, size_t size);
 
 uint64_t fnv_1a(const char* bytes, size_t l);
 
+// Hash in the style of wyhash that consumes 8 or 16 bytes per step, used for interning and
+// other lookups keyed on byte strings. Values are not stable across platforms.
+uint64_t hash_bytes(const char* bytes, size_t l);
+
+
+struct ArenaStats
+{
+  size_t bytesRequested = 0;  // Sum of sizes passed to alloc
+  size_t bytesReserved = 0;   // Sum of page sizes
+  size_t pages = 0;
+  size_t bytesWasted = 0;     // Unused tails of pages left behind when a new page was started
+  size_t hugePages = 0;       // Pages mapped for huge pages, see Arena::hugePages
+
+  void add(const ArenaStats& other);
+};
 
 struct Arena
 {
@@ -25,15 +42,42 @@ struct Arena
 
   ~Arena() { clear(); }
 
-  uint8_t * first = nullptr;
-  uint8_t * curr = nullptr;
+  struct Mark
+  {
+    uint8_t* first;
+    uint8_t* curr;
+    size_t fill;
+    size_t size;
+    ArenaStats stats;
+  };
+
+  uint8_t * first = nullptr;  // Most recently allocated page, each page links to the one before
+  uint8_t * curr = nullptr;   // Page currently being filled
   size_t fill = 0;
   size_t size = 0;
 
+  // Allocations larger than a quarter of a page that do not fit in the current page get a page
+  // of their own, so the rest of the current page is still used.
+  size_t pageSize = 1024 * 1024;
+
+  // Back pages with huge pages (MAP_HUGETLB, or madvise(MADV_HUGEPAGE) if none are reserved)
+  // where supported, rounding pages up to the huge page size. Ignored on other platforms.
+  bool hugePages = false;
+
+  ArenaStats stats;
+
   void* alloc(size_t bytes);
   void* dup(const void* src, size_t bytes);
   void clear();
 
+  // Takes over the pages of other, leaving it empty. Allocations already made from other stay valid.
+  void adopt(Arena& other);
+
+  // Releases everything allocated after mark was taken, for scoped temporaries. Pages adopted
+  // in between must not be rewound past.
+  Mark mark() const { return Mark{ first, curr, fill, size, stats }; }
+  void rewind(const Mark& mark);
+
   template<typename T> T * alloc() { return new(alloc(sizeof(T))) T(); }
 };
 
@@ -70,6 +114,9 @@ struct Buffer : public BufferBase
 };
 
 
+// Open-addressing hash map from non-zero 64-bit keys to 64-bit values. Laid out like a Swiss
+// table: one control byte per slot holding 7 bits of the hash (or empty), which are probed 16
+// at a time, and interleaved key/value slots. Entries are never removed, so no tombstones.
 struct Map
 {
   Map() = default;
@@ -79,26 +126,50 @@ struct Map
 
   ~Map();
 
-  uint64_t* keys = nullptr;
-  uint64_t* vals = nullptr;
+  struct Slot
+  {
+    uint64_t key;
+    uint64_t val;
+  };
+
+  uint8_t* ctrl = nullptr;  // capacity + 16 bytes, the last 16 mirror the first 16
+  Slot* slots = nullptr;
   size_t fill = 0;
   size_t capacity = 0;
 
   void clear();
 
+  // Make room for count entries without further rehashing.
+  void reserve(size_t count);
+
   bool get(uint64_t& val, uint64_t key);
   uint64_t get(uint64_t key);
 
   void insert(uint64_t key, uint64_t value);
+
+private:
+  void rehash(size_t newCapacity);
 };
 
+// Maps equal strings to the same pointer. Can be used from several threads at once: the table
+// is split into shards selected by the hash, each with its own lock, map and arena, so threads
+// only contend when they intern into the same shard at the same time.
 struct StringInterning
 {
-  Arena arena;
-  Map map;
+  StringInterning();
+  ~StringInterning();
+  StringInterning(const StringInterning&) = delete;
+  StringInterning& operator=(const StringInterning&) = delete;
 
   const char* intern(const char* a, const char* b);
   const char* intern(const char* str);  // null terminanted
+
+  // Arena statistics summed over all shards.
+  ArenaStats stats();
+
+private:
+  struct Shard;
+  Shard* shards = nullptr;
 };
 
 uint64_t fnv_1a(const char* bytes, size_t l);
@@ -106,9 +177,12 @@ uint64_t fnv_1a(const char* bytes, size_t l);
 
 
 bool flattenRegex(Store* store, Logger logger, const char* regex);
-void connect(Store* store, Logger logger);
-void align(Store* store, Logger logger);
+void connect(Store* store, Logger logger, Instrumentation* instrumentation = nullptr);
+void align(Store* store, Logger logger, Instrumentation* instrumentation = nullptr);
 bool exportJson(Store* store, Logger logger, const char* path);
 bool discardGroups(Store* store, Logger logger, const void* ptr, size_t size);
 bool exportRev(Store* store, Logger logger, const char* path);
-bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel, bool rotateZToY, bool centerModel, bool includeAttributes, bool mergeGeometries);
+bool exportRvm(Store* store, Logger logger, const char* path);
+bool exportAtt(Store* store, Logger logger, const char* path);
+bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel, bool rotateZToY, bool centerModel, bool includeAttributes, bool mergeGeometries, bool quantize, bool meshoptCompression, size_t threads);
+bool exportTiles(Store* store, Logger logger, const char* path, size_t maxTrianglesPerTile, bool quantize, bool meshoptCompression, size_t threads);
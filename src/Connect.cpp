@@ -3,6 +3,7 @@
 #include <cmath>
 #include <chrono>
 #include "Common.h"
+#include "Instrumentation.h"
 #include "Store.h"
 #include "LinAlgOps.h"
 
@@ -77,8 +78,8 @@ namespace {
           connection->setFlag(a[i].flags);
           connection->setFlag(a[j].flags);
 
-          a[j].geo->connections[a[j].o] = connection;
-          a[i].geo->connections[a[i].o] = connection;
+          context->store->setConnection(a[j].geo, a[j].o, connection);
+          context->store->setConnection(a[i].geo, a[i].o, connection);
 
           a[j].matched = true;
           a[i].matched = true;
@@ -250,7 +251,7 @@ namespace {
 }
 
 
-void connect(Store* store, Logger logger)
+void connect(Store* store, Logger logger, Instrumentation* instrumentation)
 {
 
   Context context;
@@ -287,5 +288,9 @@ void connect(Store* store, Logger logger)
   auto e0 = std::chrono::duration_cast<std::chrono::milliseconds>((time1 - time0)).count();
 
   logger(0, "Matched %u of %u anchors (%lldms).", context.anchors_matched, context.anchors_total, e0);
+  if (instrumentation) {
+    instrumentation->addCounter("connect", "anchorsTotal", context.anchors_total);
+    instrumentation->addCounter("connect", "anchorsMatched", context.anchors_matched);
+  }
 
 }
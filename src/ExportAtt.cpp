@@ -0,0 +1,74 @@
+#include "Common.h"
+#include "Store.h"
+#include "Trace.h"
+
+#include <cstdio>
+#include <cassert>
+
+namespace {
+
+  // Writes the attribute text format read by parseAtt: a header line, then for each group a
+  // NEW line with its name, its attributes as key := 'value' and the groups below it, closed by
+  // END. Values are quoted, parseAtt strips the quotes again.
+  struct Context {
+    Logger logger = nullptr;
+    FILE* out = nullptr;
+  };
+
+  void writeGroup(Context* ctx, const Node* group, unsigned level)
+  {
+    assert(group->kind == Node::Kind::Group);
+    fprintf(ctx->out, "%*sNEW %s\n", 2 * level, "", group->group.name ? group->group.name : "");
+    for (const Attribute* att = group->attributes.first; att; att = att->next) {
+      fprintf(ctx->out, "%*s%s := '%s'\n", 2 * level + 2, "", att->key, att->val ? att->val : "");
+    }
+    for (const Node* child = group->children.first; child; child = child->next) {
+      writeGroup(ctx, child, level + 1);
+    }
+    fprintf(ctx->out, "%*sEND\n", 2 * level, "");
+  }
+
+}
+
+bool exportAtt(Store* store, Logger logger, const char* path)
+{
+  Context ctx;
+  ctx.logger = logger;
+
+#ifdef _WIN32
+  auto err = fopen_s(&ctx.out, path, "w");
+  if (err != 0) {
+    char buf[1024];
+    if (strerror_s(buf, sizeof(buf), err) != 0) {
+      buf[0] = '\0';
+    }
+    logger(2, "exportAtt: Failed to open %s for writing: %s", path, buf);
+    return false;
+  }
+  assert(ctx.out);
+#else
+  ctx.out = fopen(path, "w");
+  if (ctx.out == nullptr) {
+    logger(2, "exportAtt: Failed to open %s for writing.", path);
+    return false;
+  }
+#endif
+  logger(0, "exportAtt: Writing %s...", path);
+  setvbuf(ctx.out, nullptr, _IOFBF, 1024 * 1024);
+  fprintf(ctx.out, "CADC_Attributes_File v1.0 , start: NEW , end: END , name_end: END , sep: :=\n");
+  for (const Node* file = store->getFirstRoot(); file; file = file->next) {
+    for (const Node* model = file->children.first; model; model = model->next) {
+      for (const Node* group = model->children.first; group; group = group->next) {
+        auto trace = traceGroup(group);
+        writeGroup(&ctx, group, 0);
+      }
+    }
+  }
+  bool writeError = ferror(ctx.out) != 0;
+  if (fclose(ctx.out) != 0 || writeError) {
+    logger(2, "exportAtt: Failed to write %s.", path);
+    return false;
+  }
+  logger(0, "exportAtt: Writing %s... done", path);
+  return true;
+}
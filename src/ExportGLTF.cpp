@@ -9,6 +9,8 @@
 #include <span>
 #include <memory>
 #include <cctype>
+#include <thread>
+#include <atomic>
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
@@ -16,7 +18,9 @@
 #include <rapidjson/filewritestream.h>
 
 #include "Store.h"
+#include "Trace.h"
 #include "LinAlgOps.h"
+#include "Base64.h"
 
 #define RVMPARSER_GLTF_PRETTY_PRINT (0)
 
@@ -50,6 +54,11 @@ namespace {
     Map definedMaterials;
 
     Vec3f origin = makeVec3f(0.f);
+    BBox3f bounds = createEmptyBBox3f();  // World bounds of the geometries included in this file
+
+    uint32_t fallbackBytes = 0;     // Size of uncompressed data in meshopt fallback buffer
+    bool usesQuantization = false;  // True if any accessor relies on KHR_mesh_quantization
+    bool usesMeshopt = false;       // True if any buffer view relies on EXT_meshopt_compression
   };
 
   struct GeometryItem
@@ -68,8 +77,17 @@ namespace {
     std::vector<Vec3f> tmp3f_1;
     std::vector<Vec3f> tmp3f_2;
     std::vector<uint32_t> tmp32ui;
+    std::vector<int16_t> tmp16i;
+    std::vector<int8_t> tmp8i;
+    std::vector<uint8_t> tmpMeshopt;
     std::vector<GeometryItem> tmpGeos;
 
+    // Mapping from quantized positions of the current mesh to its frame, i.e. p = offset + scale * q
+    struct {
+      Vec3f offset = makeVec3f(0.f);
+      float scale = 1.f;
+    } dequantize;
+
     struct {
       size_t level = 0;   // Level to do splitting, 0 for no splitting
       size_t choose = 0;  // Keeping track of which split we are processing
@@ -82,6 +100,8 @@ namespace {
     bool includeAttributes = false;
     bool glbContainer = false;
     bool mergeGeometries = true;
+    bool quantize = false;
+    bool meshoptCompression = false;
   };
 
 
@@ -107,55 +127,225 @@ namespace {
     return offset;
   }
 
-  void encodeBase64(Context& ctx, const uint8_t* data, size_t byteLength)
+  // True if buffer view data ends up unmodified in the model's data items, i.e. not
+  // compressed, so producers can write it straight into memory that becomes the data
+  // item instead of into a scratch buffer that is copied afterwards.
+  bool storesDataAsIs(const Context& ctx)
+  {
+    return !ctx.meshoptCompression;
+  }
+
+  // Returns memory for count elements of buffer view data, either owned by the model if
+  // direct is set, or the scratch buffer. Pass !direct as copy when creating the view.
+  template<typename T>
+  T* allocBufferData(Model& model, std::vector<T>& scratch, size_t count, bool direct)
+  {
+    if (direct) {
+      return static_cast<T*>(model.arena.alloc(sizeof(T) * count));
+    }
+    scratch.resize(count);
+    return scratch.data();
+  }
+
+  // Buffers of .gltf files get this as uri, and the data is appended while writing. The uri
+  // refers to this array without copying, so the writer recognizes it by address and not by
+  // content, which an attribute value could reproduce.
+  const char dataUriPrefix[] = "data:application/octet-stream;base64,";
+  const size_t dataUriPrefixLength = sizeof(dataUriPrefix) - 1;
+
+  // Encoder for the EXT_meshopt_compression byte codecs, see
+  // https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Vendor/EXT_meshopt_compression
+  //
+  // Attribute data (format version 0) is split into blocks of vertices, and
+  // for each byte position within a vertex, the zigzag-encoded deltas to the
+  // previous vertex are stored in groups of 16 using 0, 2, 4 or 8 bits per
+  // delta, whatever is smallest.
+  void meshoptEncodeBytes(std::vector<uint8_t>& out, const uint8_t* buffer, size_t bufferSize)
+  {
+    assert((bufferSize % 16) == 0);
+    const size_t headerOffset = out.size();
+    const size_t headerSize = (bufferSize / 16 + 3) / 4;
+    out.resize(headerOffset + headerSize, 0);
+
+    for (size_t i = 0; i < bufferSize; i += 16) {
+      const uint8_t* group = buffer + i;
+
+      bool allZero = true;
+      size_t size2 = 4;   // 2-bit packing, values 3 and up are stored explicitly
+      size_t size4 = 8;   // 4-bit packing, values 15 and up are stored explicitly
+      for (size_t k = 0; k < 16; k++) {
+        allZero = allZero && group[k] == 0;
+        size2 += group[k] >= 3 ? 1 : 0;
+        size4 += group[k] >= 15 ? 1 : 0;
+      }
+      unsigned bitsLog2 = 3;
+      if (allZero) bitsLog2 = 0;
+      else if (size2 <= size4 && size2 < 16) bitsLog2 = 1;
+      else if (size4 < 16) bitsLog2 = 2;
+
+      const size_t groupIndex = i / 16;
+      out[headerOffset + groupIndex / 4] |= static_cast<uint8_t>(bitsLog2 << (2 * (groupIndex % 4)));
+
+      if (bitsLog2 == 1 || bitsLog2 == 2) {
+        const unsigned bits = bitsLog2 == 1 ? 2 : 4;
+        const unsigned sentinel = (1u << bits) - 1;
+        const unsigned perByte = 8 / bits;
+        for (size_t k = 0; k < 16; k += perByte) {
+          unsigned byte = 0;
+          for (size_t m = 0; m < perByte; m++) {
+            byte = (byte << bits) | std::min(unsigned(group[k + m]), sentinel);
+          }
+          out.push_back(static_cast<uint8_t>(byte));
+        }
+        for (size_t k = 0; k < 16; k++) {
+          if (sentinel <= group[k]) out.push_back(group[k]);
+        }
+      }
+      else if (bitsLog2 == 3) {
+        out.insert(out.end(), group, group + 16);
+      }
+    }
+  }
+
+  void meshoptEncodeVertexBuffer(std::vector<uint8_t>& out, const uint8_t* vertexData, size_t vertexCount, size_t vertexSize)
+  {
+    assert(vertexCount);
+    assert((vertexSize % 4) == 0 && vertexSize <= 256);
+
+    out.clear();
+    out.push_back(0xa0);  // Header and version 0
+
+    // The first vertex is the initial baseline, it is stored in the tail
+    uint8_t last[256];
+    std::memcpy(last, vertexData, vertexSize);
+
+    const size_t blockSize = std::min((8192 / vertexSize) & ~size_t(15), size_t(256));
+    uint8_t buffer[256];
+    for (size_t offset = 0; offset < vertexCount; offset += blockSize) {
+      const size_t n = std::min(blockSize, vertexCount - offset);
+      const size_t nAligned = (n + 15) & ~size_t(15);
+      for (size_t k = 0; k < vertexSize; k++) {
+        uint8_t p = last[k];
+        for (size_t i = 0; i < n; i++) {
+          const uint8_t v = vertexData[vertexSize * (offset + i) + k];
+          const uint8_t d = static_cast<uint8_t>(v - p);
+          buffer[i] = static_cast<uint8_t>((d << 1) ^ static_cast<uint8_t>(static_cast<int8_t>(d) >> 7));
+          p = v;
+        }
+        std::memset(buffer + n, 0, nAligned - n);
+        meshoptEncodeBytes(out, buffer, nAligned);
+        last[k] = p;
+      }
+    }
+
+    const size_t tailSize = std::max(vertexSize, size_t(32));
+    out.resize(out.size() + tailSize - vertexSize, 0);
+    out.insert(out.end(), vertexData, vertexData + vertexSize);
+  }
+
+  // Index sequence codec (format version 1): Each index is stored as a
+  // varint of the zigzag-encoded delta to one of two baselines.
+  void meshoptEncodeIndexSequence(std::vector<uint8_t>& out, const uint32_t* indices, size_t count)
   {
-    // Base64 table from RFC4648
-    static const char rfc4648[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    static_assert(sizeof(rfc4648) == 65);
-
-    static const char prefix[] = "data:application/octet-stream;base64,";
-    static const size_t prefixLength = sizeof(prefix) - 1;
-
-    // Add data prefix
-    const size_t totalLength = prefixLength + 4 * ((byteLength + 2) / 3);
-    ctx.tmpBase64.resize(totalLength);
-    std::memcpy(ctx.tmpBase64.data(), prefix, prefixLength);
-    size_t o = prefixLength;
-
-    // Handle range that is a multiple of three
-    size_t i = 0;
-    while (3 * i + 2 < byteLength) {
-      const size_t i3 = 3 * i;
-      const size_t i4 = 4 * i;
-      const uint8_t d0 = data[i3 + 0];
-      const uint8_t d1 = data[i3 + 1];
-      const uint8_t d2 = data[i3 + 2];
-      ctx.tmpBase64[o + i4 + 0] = rfc4648[(d0 >> 2)];
-      ctx.tmpBase64[o + i4 + 1] = rfc4648[((d0 << 4) & 0x30) | (d1 >> 4)];
-      ctx.tmpBase64[o + i4 + 2] = rfc4648[((d1 << 2) & 0x3c) | (d2 >> 6)];
-      ctx.tmpBase64[o + i4 + 3] = rfc4648[d2 & 0x3f];
-      i++;
-    }
-
-    // Handle end if byteLength is not a multiple of three
-    if (3 * i < byteLength) { // End padding
-      const size_t i3 = 3 * i;
-      const size_t i4 = 4 * i;
-      const bool two = (i3 + 1 < byteLength);  // one or two extra bytes (three would go into loop above)?
-      const uint8_t d0 = data[i3 + 0];
-      const uint8_t d1 = two ? data[i3 + 1] : 0;
-      ctx.tmpBase64[o + i4 + 0] = rfc4648[(d0 >> 2)];
-      ctx.tmpBase64[o + i4 + 1] = rfc4648[((d0 << 4) & 0x30) | (d1 >> 4)];
-      ctx.tmpBase64[o + i4 + 2] = two ? rfc4648[((d1 << 2) & 0x3c)] : '=';
-      ctx.tmpBase64[o + i4 + 3] = '=';
-    }
-  }
-
-  uint32_t createBufferView(Context& ctx, Model& model, const void* data, size_t count, size_t byte_stride, uint32_t target, bool copy)
+    out.clear();
+    out.push_back(0xd1);  // Header and version 1
+
+    uint32_t last[2] = { 0, 0 };
+    unsigned current = 0;
+    for (size_t i = 0; i < count; i++) {
+      const uint32_t index = indices[i];
+
+      // Switch baseline when the delta becomes too large to fit in a byte
+      const int32_t cd = static_cast<int32_t>(index - last[current]);
+      current ^= (cd < 0 ? -cd : cd) >= 30 ? 1 : 0;
+
+      const uint32_t d = index - last[current];
+      uint32_t v = (((d << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(d) >> 31)) << 1) | current;
+      while (128 <= v) {
+        out.push_back(static_cast<uint8_t>((v & 127) | 128));
+        v >>= 7;
+      }
+      out.push_back(static_cast<uint8_t>(v));
+      last[current] = index;
+    }
+
+    for (size_t k = 0; k < 4; k++) {
+      out.push_back(0);
+    }
+  }
+
+  // Adds a meshopt-compressed version of the data to the GLB buffer, and lets
+  // the buffer view itself refer to the uncompressed fallback buffer.
+  void addMeshoptBufferView(Context& ctx, Model& model, rj::Value& rjBufferView, const void* data, size_t count, size_t byte_stride, uint32_t target, const char* filter)
+  {
+    rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
+
+    const char* mode = nullptr;
+    if (target == 0x8893 /* GL_ELEMENT_ARRAY_BUFFER */) {
+      assert(byte_stride == sizeof(uint32_t));
+      meshoptEncodeIndexSequence(ctx.tmpMeshopt, static_cast<const uint32_t*>(data), count);
+      mode = "INDICES";
+    }
+    else {
+      meshoptEncodeVertexBuffer(ctx.tmpMeshopt, static_cast<const uint8_t*>(data), count, byte_stride);
+      mode = "ATTRIBUTES";
+    }
+
+    // Codec requires the exact length, padding is outside the range.
+    const size_t compressedLength = ctx.tmpMeshopt.size();
+    ctx.tmpMeshopt.resize((compressedLength + 3) & ~size_t(3), 0);
+    uint32_t compressedOffset = addDataItem(ctx, model, ctx.tmpMeshopt.data(), ctx.tmpMeshopt.size(), true);
+
+    rj::Value rjMeshopt(rj::kObjectType);
+    rjMeshopt.AddMember("buffer", 0, alloc);
+    rjMeshopt.AddMember("byteOffset", compressedOffset, alloc);
+    rjMeshopt.AddMember("byteLength", static_cast<uint64_t>(compressedLength), alloc);
+    rjMeshopt.AddMember("byteStride", static_cast<uint64_t>(byte_stride), alloc);
+    rjMeshopt.AddMember("count", static_cast<uint64_t>(count), alloc);
+    rjMeshopt.AddMember("mode", rj::StringRef(mode), alloc);
+    if (filter) {
+      rjMeshopt.AddMember("filter", rj::StringRef(filter), alloc);
+    }
+
+    rj::Value rjExtensions(rj::kObjectType);
+    rjExtensions.AddMember("EXT_meshopt_compression", rjMeshopt, alloc);
+
+    size_t byteLength = byte_stride * count;
+    rjBufferView.AddMember("buffer", 1, alloc);
+    if (model.fallbackBytes) {
+      rjBufferView.AddMember("byteOffset", model.fallbackBytes, alloc);
+    }
+    rjBufferView.AddMember("byteLength", static_cast<uint64_t>(byteLength), alloc);
+    rjBufferView.AddMember("extensions", rjExtensions, alloc);
+
+    assert(model.fallbackBytes + byteLength <= std::numeric_limits<uint32_t>::max());
+    model.fallbackBytes += static_cast<uint32_t>((byteLength + 3) & ~size_t(3));
+    model.usesMeshopt = true;
+  }
+
+  // Set explicitStride if elements are padded, and filter to the meshopt filter
+  // that applies to the data if it gets compressed.
+  uint32_t createBufferView(Context& ctx, Model& model, const void* data, size_t count, size_t byte_stride, uint32_t target, bool copy,
+                            bool explicitStride = false, const char* filter = nullptr)
   {
     assert(count);
     rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
 
+    rj::Value rjBufferView(rj::kObjectType);
+
+    // Compressed data lives in the GLB buffer, while the view itself refers to the fallback buffer
+    if (ctx.glbContainer && ctx.meshoptCompression) {
+      addMeshoptBufferView(ctx, model, rjBufferView, data, count, byte_stride, target, filter);
+      if (explicitStride) {
+        rjBufferView.AddMember("byteStride", static_cast<uint64_t>(byte_stride), alloc);
+      }
+      rjBufferView.AddMember("target", target, alloc);
+
+      uint32_t view_ix = model.rjBufferViews.Size();
+      model.rjBufferViews.PushBack(rjBufferView, alloc);
+      return view_ix;
+    }
+
     uint32_t bufferIndex = 0;
     uint32_t byteOffset = 0;
     size_t byteLength = byte_stride * count;
@@ -165,25 +355,26 @@ namespace {
       byteOffset = addDataItem(ctx, model, data, byteLength, copy);
     }
 
-    // For GLTF, buffer data is base64-encoded in the URI
+    // For GLTF, buffer data is base64-encoded in the URI. The encoding is done by
+    // DataUriWriter when the file is written, so here we just hold on to the data.
     else {
-
-      encodeBase64(ctx, static_cast<const uint8_t*>(data), byteLength);
-      rj::Value rjData(ctx.tmpBase64.data(), static_cast<rapidjson::SizeType>(ctx.tmpBase64.size()), alloc);
+      addDataItem(ctx, model, data, byteLength, copy);
 
       rj::Value rjBuffer(rj::kObjectType);
-      rjBuffer.AddMember("uri", rjData, alloc);
+      rjBuffer.AddMember("uri", rj::StringRef(dataUriPrefix, dataUriPrefixLength), alloc);
       rjBuffer.AddMember("byteLength", static_cast<uint64_t>(byteLength), alloc);
       bufferIndex = model.rjBufferViews.Size();
       model.rjBuffers.PushBack(rjBuffer, alloc);
     }
 
-    rj::Value rjBufferView(rj::kObjectType);
     rjBufferView.AddMember("buffer", bufferIndex, alloc);
     if (byteOffset) {
       rjBufferView.AddMember("byteOffset", byteOffset, alloc);
     }
     rjBufferView.AddMember("byteLength", static_cast<uint64_t>(byteLength), alloc);
+    if (explicitStride) {
+      rjBufferView.AddMember("byteStride", static_cast<uint64_t>(byte_stride), alloc);
+    }
 
     rjBufferView.AddMember("target", target, alloc);
 
@@ -232,6 +423,141 @@ namespace {
     return accessor_ix;
   }
 
+  // Quantized positions are stored as VEC3 of int16 padded to 8 bytes, and the
+  // mapping back to the mesh frame, ctx.dequantize, must be added to the node
+  // transform, as described by KHR_mesh_quantization.
+  uint32_t createAccessorPositions(Context& ctx, Model& model, const Vec3f* data, size_t count, bool copy)
+  {
+    assert(count);
+    if (!ctx.quantize) {
+      return createAccessorVec3f(ctx, model, data, count, copy);
+    }
+
+    const Vec3f offset = ctx.dequantize.offset;
+    const float invScale = 1.f / ctx.dequantize.scale;
+
+    const bool direct = storesDataAsIs(ctx);
+    int16_t* Q = allocBufferData(model, ctx.tmp16i, 4 * count, direct);
+
+    int min_val[3] = { std::numeric_limits<int16_t>::max(), std::numeric_limits<int16_t>::max(), std::numeric_limits<int16_t>::max() };
+    int max_val[3] = { std::numeric_limits<int16_t>::min(), std::numeric_limits<int16_t>::min(), std::numeric_limits<int16_t>::min() };
+    for (size_t i = 0; i < count; i++) {
+      for (size_t k = 0; k < 3; k++) {
+        float q = std::round(invScale * (data[i][k] - offset[k]));
+        int v = static_cast<int>(std::min(32767.f, std::max(-32767.f, q)));
+        min_val[k] = std::min(min_val[k], v);
+        max_val[k] = std::max(max_val[k], v);
+        Q[4 * i + k] = static_cast<int16_t>(v);
+      }
+      Q[4 * i + 3] = 0;
+    }
+
+    uint32_t view_ix = createBufferView(ctx, model,
+                                        Q,
+                                        count,
+                                        4 * static_cast<uint32_t>(sizeof(int16_t)),
+                                        0x8892 /* GL_ARRAY_BUFFER */,
+                                        !direct,
+                                        true);
+
+    rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
+    rj::Value rjMin(rj::kArrayType);
+    rj::Value rjMax(rj::kArrayType);
+    for (size_t k = 0; k < 3; k++) {
+      rjMin.PushBack(min_val[k], alloc);
+      rjMax.PushBack(max_val[k], alloc);
+    }
+
+    rj::Value rjAccessor(rj::kObjectType);
+    rjAccessor.AddMember("bufferView", view_ix, alloc);
+    rjAccessor.AddMember("byteOffset", 0, alloc);
+    rjAccessor.AddMember("type", "VEC3", alloc);
+    rjAccessor.AddMember("componentType", 0x1402 /* GL_SHORT */, alloc);
+    rjAccessor.AddMember("count", static_cast<uint64_t>(count), alloc);
+    rjAccessor.AddMember("min", rjMin, alloc);
+    rjAccessor.AddMember("max", rjMax, alloc);
+
+    uint32_t accessor_ix = model.rjAccessors.Size();
+    model.rjAccessors.PushBack(rjAccessor, alloc);
+    model.usesQuantization = true;
+    return accessor_ix;
+  }
+
+  int quantizeSnorm8(float v)
+  {
+    v = std::min(1.f, std::max(-1.f, v));
+    return static_cast<int>(127.f * v + (0.f <= v ? 0.5f : -0.5f));
+  }
+
+  // Quantized normals are stored as normalized VEC3 of int8 padded to 4 bytes.
+  // With meshopt compression, they are octahedral-encoded and expanded by the
+  // OCTAHEDRAL filter when decoded.
+  uint32_t createAccessorNormals(Context& ctx, Model& model, const Vec3f* data, size_t count, bool copy)
+  {
+    assert(count);
+    if (!ctx.quantize) {
+      return createAccessorVec3f(ctx, model, data, count, copy);
+    }
+
+    const bool octahedral = ctx.glbContainer && ctx.meshoptCompression;
+
+    const bool direct = storesDataAsIs(ctx);
+    int8_t* Q = allocBufferData(model, ctx.tmp8i, 4 * count, direct);
+    for (size_t i = 0; i < count; i++) {
+      const Vec3f& n = data[i];
+      if (octahedral) {
+        float l = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        float s = l == 0.f ? 0.f : 1.f / l;
+        float x = s * n.x;
+        float y = s * n.y;
+        float u = 0.f <= n.z ? x : (1.f - std::abs(y)) * (0.f <= x ? 1.f : -1.f);
+        float v = 0.f <= n.z ? y : (1.f - std::abs(x)) * (0.f <= y ? 1.f : -1.f);
+        Q[4 * i + 0] = static_cast<int8_t>(quantizeSnorm8(u));
+        Q[4 * i + 1] = static_cast<int8_t>(quantizeSnorm8(v));
+        Q[4 * i + 2] = 127;
+      }
+      else {
+        Q[4 * i + 0] = static_cast<int8_t>(quantizeSnorm8(n.x));
+        Q[4 * i + 1] = static_cast<int8_t>(quantizeSnorm8(n.y));
+        Q[4 * i + 2] = static_cast<int8_t>(quantizeSnorm8(n.z));
+      }
+      Q[4 * i + 3] = 0;
+    }
+
+    uint32_t view_ix = createBufferView(ctx, model,
+                                        Q,
+                                        count,
+                                        4 * static_cast<uint32_t>(sizeof(int8_t)),
+                                        0x8892 /* GL_ARRAY_BUFFER */,
+                                        !direct,
+                                        true,
+                                        octahedral ? "OCTAHEDRAL" : nullptr);
+
+    rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
+    rj::Value rjAccessor(rj::kObjectType);
+    rjAccessor.AddMember("bufferView", view_ix, alloc);
+    rjAccessor.AddMember("byteOffset", 0, alloc);
+    rjAccessor.AddMember("type", "VEC3", alloc);
+    rjAccessor.AddMember("componentType", 0x1400 /* GL_BYTE */, alloc);
+    rjAccessor.AddMember("normalized", true, alloc);
+    rjAccessor.AddMember("count", static_cast<uint64_t>(count), alloc);
+
+    uint32_t accessor_ix = model.rjAccessors.Size();
+    model.rjAccessors.PushBack(rjAccessor, alloc);
+    model.usesQuantization = true;
+    return accessor_ix;
+  }
+
+  // Set up ctx.dequantize such that the int16 range covers bounds.
+  void setQuantizationBounds(Context& ctx, const BBox3f& bounds)
+  {
+    ctx.dequantize.offset = 0.5f * (bounds.min + bounds.max);
+    ctx.dequantize.scale = (1.f / 32767.f) * 0.5f * maxSideLength(bounds);
+    if (!(0.f < ctx.dequantize.scale) || !std::isfinite(ctx.dequantize.scale)) {
+      ctx.dequantize.scale = 1.f;
+    }
+  }
+
   uint32_t createAccessorUint32(Context& ctx, Model& model, const uint32_t* data, size_t count, bool copy)
   {
     assert(count);
@@ -330,7 +656,7 @@ namespace {
 
       rj::Value rjAttributes(rj::kObjectType);
 
-      uint32_t accessor_ix = createAccessorVec3f(ctx, model, (Vec3f*)positions, 2, true);
+      uint32_t accessor_ix = createAccessorPositions(ctx, model, (Vec3f*)positions, 2, true);
       rjAttributes.AddMember("POSITION", accessor_ix, alloc);
 
       rjPrimitive.AddMember("attributes", rjAttributes, alloc);
@@ -355,15 +681,15 @@ namespace {
       rj::Value rjAttributes(rj::kObjectType);
 
       if (tri->vertices) {
-        uint32_t accessor_ix = createAccessorVec3f(ctx, model, (Vec3f*)tri->vertices, tri->vertices_n, false);
+        uint32_t accessor_ix = createAccessorPositions(ctx, model, (Vec3f*)tri->vertices, tri->vertices_n, false);
         rjAttributes.AddMember("POSITION", accessor_ix, alloc);
       }
 
       if (tri->normals) {
 
         // Make sure that normal vectors are of unit length
-        std::vector<Vec3f>& tmpNormals = ctx.tmp3f_1;
-        tmpNormals.resize(tri->vertices_n * 3);
+        const bool direct = storesDataAsIs(ctx) && !ctx.quantize;
+        Vec3f* tmpNormals = allocBufferData(model, ctx.tmp3f_1, tri->vertices_n, direct);
         for (size_t i = 0; i < tri->vertices_n; i++) {
           Vec3f n = normalize(makeVec3f(tri->normals + 3 * i));
           if (!std::isfinite(n.x) || !std::isfinite(n.y) || !std::isfinite(n.z)) {
@@ -372,8 +698,8 @@ namespace {
           tmpNormals[i] = n;
         }
 
-        // And make a copy when setting up the accessor
-        uint32_t accessor_ix = createAccessorVec3f(ctx, model, tmpNormals.data(), tri->vertices_n, true);
+        // And make a copy when setting up the accessor unless written in place
+        uint32_t accessor_ix = createAccessorNormals(ctx, model, tmpNormals, tri->vertices_n, !direct);
         rjAttributes.AddMember("NORMAL", accessor_ix, alloc);
       }
 
@@ -394,6 +720,21 @@ namespace {
   {
     rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
 
+    // Quantized positions are relative to the center of the local bounds
+    if (ctx.quantize) {
+      BBox3f bounds = createEmptyBBox3f();
+      if (geo->kind == Geometry::Kind::Line) {
+        engulf(bounds, makeVec3f(geo->line.a, 0.f, 0.f));
+        engulf(bounds, makeVec3f(geo->line.b, 0.f, 0.f));
+      }
+      else if (geo->triangulation) {
+        for (size_t i = 0; i < geo->triangulation->vertices_n; i++) {
+          engulf(bounds, makeVec3f(geo->triangulation->vertices + 3 * i));
+        }
+      }
+      setQuantizationBounds(ctx, bounds);
+    }
+
     rj::Value rjPrimitives(rj::kArrayType);
     addGeometryPrimitive(ctx, model, rjPrimitives, geo);
 
@@ -408,15 +749,24 @@ namespace {
 
     node.AddMember("mesh", meshIndex, alloc);
 
+    // Fold dequantization into the geometry transform
+    Mat3x4f M = geo->M_3x4;
+    if (ctx.quantize) {
+      for (size_t c = 0; c < 3; c++) {
+        M.cols[c] = ctx.dequantize.scale * geo->M_3x4.cols[c];
+      }
+      M.cols[3] = mul(geo->M_3x4, ctx.dequantize.offset);
+    }
+
     rj::Value matrix(rj::kArrayType);
     for (size_t c = 0; c < 3; c++) {
       for (size_t r = 0; r < 3; r++) {
-        matrix.PushBack(geo->M_3x4.cols[c][r], alloc);
+        matrix.PushBack(M.cols[c][r], alloc);
       }
       matrix.PushBack(0.f, alloc);
     }
     for (size_t r = 0; r < 3; r++) {
-      matrix.PushBack(geo->M_3x4.cols[3][r] - model.origin[r], alloc);
+      matrix.PushBack(M.cols[3][r] - model.origin[r], alloc);
     }
     matrix.PushBack(1.f, alloc);
 
@@ -428,7 +778,10 @@ namespace {
   bool addPrimitiveForLines(Context& ctx, Model& model, rj::Value& rjPrimitives, const std::span<const GeometryItem>& geos, const Vec3d& localOrigin)
   {
     assert(!geos.empty());
-    std::vector<Vec3f>& V = ctx.tmp3f_1;  // No need to clear, they get resized before written to
+
+    // Unquantized positions can be written directly into their final location
+    const bool direct = storesDataAsIs(ctx) && !ctx.quantize;
+    Vec3f* V = allocBufferData(model, ctx.tmp3f_1, 2 * geos.size(), direct);
     size_t vertexOffset = 0;
 
     for (const GeometryItem& item : geos) {
@@ -441,13 +794,12 @@ namespace {
       M.m13 -= localOrigin.y;
       M.m23 -= localOrigin.z;
 
-      V.resize(vertexOffset + 2);
       V[vertexOffset + 0] = makeVec3f(mul(M, makeVec3d(geo->line.a, 0.0, 0.0)));
       V[vertexOffset + 1] = makeVec3f(mul(M, makeVec3d(geo->line.b, 0.0, 0.0)));
       vertexOffset += 2;
     }
 
-    uint32_t positionAccessorIx = createAccessorVec3f(ctx, model, V.data(), vertexOffset, true);
+    uint32_t positionAccessorIx = createAccessorPositions(ctx, model, V, vertexOffset, !direct);
 
     rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
 
@@ -469,9 +821,26 @@ namespace {
   bool addPrimitiveForTriangulations(Context& ctx, Model& model, rj::Value& rjPrimitives, const std::span<const GeometryItem>& geos, const Vec3d& localOrigin)
   {
     assert(!geos.empty());
-    std::vector<Vec3f>& V = ctx.tmp3f_1;  // No need to clear, they get resized before written to
-    std::vector<Vec3f>& N = ctx.tmp3f_2;
-    std::vector<uint32_t>& I = ctx.tmp32ui;
+
+    // Count up front so that unquantized vertex data and indices can be transformed
+    // directly into their final location, touching each byte once.
+    size_t vertexCountTotal = 0;
+    size_t indexCountTotal = 0;
+    for (const GeometryItem& item : geos) {
+      if (item.geo->triangulation) {
+        vertexCountTotal += item.geo->triangulation->vertices_n;
+        indexCountTotal += 3 * item.geo->triangulation->triangles_n;
+      }
+    }
+    if (vertexCountTotal == 0 || indexCountTotal == 0) {
+      return false; // No geometry added
+    }
+
+    const bool directIndices = storesDataAsIs(ctx);
+    const bool directVertices = directIndices && !ctx.quantize;
+    Vec3f* V = allocBufferData(model, ctx.tmp3f_1, vertexCountTotal, directVertices);
+    Vec3f* N = allocBufferData(model, ctx.tmp3f_2, vertexCountTotal, directVertices);
+    uint32_t* I = allocBufferData(model, ctx.tmp32ui, indexCountTotal, directIndices);
     size_t vertexOffset = 0;
     size_t indexOffset = 0;
 
@@ -492,11 +861,8 @@ namespace {
       size_t indexCount = 3 * geo->triangulation->triangles_n;
 
       // Transform vertices and normals into new frame
-      V.resize(vertexOffset + vertexCount);
-      N.resize(vertexOffset + vertexCount);
-
       for (size_t i = 0; i < vertexCount; i++) {
-        ctx.tmp3f_1[vertexOffset + i] = makeVec3f(mul(M, makeVec3d(geo->triangulation->vertices + 3 * i)));
+        V[vertexOffset + i] = makeVec3f(mul(M, makeVec3d(geo->triangulation->vertices + 3 * i)));
         Vec3f n = normalize(mul(T, makeVec3f(geo->triangulation->normals + 3 * i)));
         if (!std::isfinite(n.x) || !std::isfinite(n.y) || !std::isfinite(n.z)) {
           n = makeVec3f(1.f, 0.f, 0.f);
@@ -505,7 +871,6 @@ namespace {
       }
 
       // Transform indices
-      I.resize(indexOffset + indexCount);
       for (size_t i = 0; i < indexCount; i++) {
         I[indexOffset + i] = static_cast<uint32_t>(vertexOffset + geo->triangulation->indices[i]);
       }
@@ -515,49 +880,51 @@ namespace {
     }
 
     //ctx.logger(2, "exportGLTF: merged %zu meshes, vertexCount=%zu, indexCount=%zu", geos.size(), vertexOffset, indexOffset);
-    if (vertexOffset != 0 && indexOffset != 0) {
-      uint32_t positionAccessorIx = createAccessorVec3f(ctx, model, V.data(), vertexOffset, true);
-      uint32_t normalAccessorIx = createAccessorVec3f(ctx, model, N.data(), vertexOffset, true);
-      uint32_t indicesAccesorIx = createAccessorUint32(ctx, model, I.data(), indexOffset, true);
-
-      rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
+    assert(vertexOffset == vertexCountTotal && indexOffset == indexCountTotal);
+    uint32_t positionAccessorIx = createAccessorPositions(ctx, model, V, vertexOffset, !directVertices);
+    uint32_t normalAccessorIx = createAccessorNormals(ctx, model, N, vertexOffset, !directVertices);
+    uint32_t indicesAccesorIx = createAccessorUint32(ctx, model, I, indexOffset, !directIndices);
 
-      rj::Value rjAttributes(rj::kObjectType);
-      rjAttributes.AddMember("POSITION", positionAccessorIx, alloc);
-      rjAttributes.AddMember("NORMAL", normalAccessorIx, alloc);
+    rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
 
-      rj::Value rjPrimitive(rj::kObjectType);
-      rjPrimitive.AddMember("mode", 0x0004 /* GL_TRIANGLES */, alloc);
-      rjPrimitive.AddMember("attributes", rjAttributes, alloc);
-      rjPrimitive.AddMember("indices", indicesAccesorIx, alloc);
-      rjPrimitive.AddMember("material", static_cast<uint32_t>(geos[0].sortKey >> 1), alloc);
+    rj::Value rjAttributes(rj::kObjectType);
+    rjAttributes.AddMember("POSITION", positionAccessorIx, alloc);
+    rjAttributes.AddMember("NORMAL", normalAccessorIx, alloc);
 
-      rjPrimitives.PushBack(rjPrimitive, alloc);
+    rj::Value rjPrimitive(rj::kObjectType);
+    rjPrimitive.AddMember("mode", 0x0004 /* GL_TRIANGLES */, alloc);
+    rjPrimitive.AddMember("attributes", rjAttributes, alloc);
+    rjPrimitive.AddMember("indices", indicesAccesorIx, alloc);
+    rjPrimitive.AddMember("material", static_cast<uint32_t>(geos[0].sortKey >> 1), alloc);
 
-      return true;  // We did add geometry
-    }
+    rjPrimitives.PushBack(rjPrimitive, alloc);
 
-    return false; // No geometry added
+    return true;  // We did add geometry
   }
 
   bool insertMergedGeometriesIntoNode(Context& ctx, Model& model, rj::Value& node, std::vector<GeometryItem>& geos)
   {
     // Calc average pos and count number of vertices
     Vec3d avg = makeVec3d(0.0, 0.0, 0.0);
+    BBox3f bounds = createEmptyBBox3f();
     {
       size_t nv = 0;
       for (const GeometryItem& item : geos) {
         const Geometry* geo = item.geo;
         const Mat3x4d M = makeMat3x4d(geo->M_3x4.data);
         if (geo->kind == Geometry::Kind::Line) {
-          avg = avg
-              + mul(M, makeVec3d(geo->line.a, 0.0, 0.0))
-              + mul(M, makeVec3d(geo->line.b, 0.0, 0.0));
+          Vec3d a = mul(M, makeVec3d(geo->line.a, 0.0, 0.0));
+          Vec3d b = mul(M, makeVec3d(geo->line.b, 0.0, 0.0));
+          avg = avg + a + b;
+          engulf(bounds, makeVec3f(a));
+          engulf(bounds, makeVec3f(b));
           nv += 2;
         }
         else if (geo->triangulation) {
           for (size_t i = 0; i < geo->triangulation->vertices_n; i++) {
-            avg = avg + mul(M, makeVec3d(geo->triangulation->vertices + 3 * i));
+            Vec3d p = mul(M, makeVec3d(geo->triangulation->vertices + 3 * i));
+            avg = avg + p;
+            engulf(bounds, makeVec3f(p));
           }
           nv += geo->triangulation->vertices_n;
         }
@@ -565,6 +932,14 @@ namespace {
       avg = (nv ? 1.0 / static_cast<double>(nv) : 0.0) * avg;
     }
 
+    // Quantized positions use the bounds center as local origin, and the
+    // node scales them back.
+    if (ctx.quantize && isNotEmpty(bounds)) {
+      setQuantizationBounds(ctx, bounds);
+      avg = makeVec3d(ctx.dequantize.offset.data);
+      ctx.dequantize.offset = makeVec3f(0.f);
+    }
+
     rj::Value rjPrimitives(rj::kArrayType);
 
     // Break down into ranges of fixed sort key (fixed material and primitive type)    
@@ -603,6 +978,14 @@ namespace {
     }
     node.AddMember("translation", translation, alloc);
 
+    if (ctx.quantize) {
+      rj::Value scale(rj::kArrayType);
+      for (size_t r = 0; r < 3; r++) {
+        scale.PushBack(ctx.dequantize.scale, alloc);
+      }
+      node.AddMember("scale", scale, alloc);
+    }
+
     return true;
   }
 
@@ -647,6 +1030,22 @@ namespace {
     }
   }
 
+  // Number of subtrees that processChildren will restrict to, i.e. nodes at the split level
+  size_t countSplits(const Context& ctx, const Node* firstChild, size_t level)
+  {
+    size_t count = 0;
+    size_t nextLevel = level + 1;
+    for (const Node* child = firstChild; child; child = child->next) {
+      if (nextLevel == ctx.split.level) {
+        count++;
+      }
+      else if (nextLevel < ctx.split.level) {
+        count += countSplits(ctx, child->children.first, nextLevel);
+      }
+    }
+    return count;
+  }
+
   void addGeometries(Context& ctx, Model& model, rj::Value& rjNode, rj::Value& rjNodeChildren, std::vector<GeometryItem>& geos, const bool modifyNodeTransform)
   {
     // Handle merging of multiple geometries
@@ -692,6 +1091,9 @@ namespace {
       includeContent = false;
     }
 
+    // Files and models are at levels 1 and 2, so top-level groups are at level 3
+    TraceScope trace(traceActive && level == 3 && node->kind == Node::Kind::Group ? traceGroupName(node) : nullptr);
+
     switch (node->kind) {
     case Node::Kind::File:
       if (node->file.path) {
@@ -724,6 +1126,7 @@ namespace {
           std::vector<GeometryItem>& geos = ctx.tmpGeos;
           geos.clear();
           for (Geometry* geo = node->group.geometries.first; geo; geo = geo->next) {
+            engulf(model.bounds, geo->bboxWorld);
             size_t sortKey = (static_cast<size_t>(createOrGetColor(ctx, model, geo)) << 1) | (geo->kind == Geometry::Kind::Line ? 1 : 0);
             geos.push_back({ .sortKey = sortKey, .geo = geo });
           }
@@ -782,14 +1185,11 @@ namespace {
                model.origin.x, model.origin.y, model.origin.z);
   }
 
-  rj::Document buildGLTF(Context& ctx, Model& model, const Node* firstNode)
+  // Creates the document and adds the asset and scene members
+  rj::Document beginGLTF(Context& ctx, Model& model)
   {
     rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
 
-    if (ctx.centerModel) {
-      calculateOrigin(ctx, model, firstNode);
-    }
-
     rj::Document rjDoc(rj::kObjectType, &alloc);
 
     // ------- asset -----------------------------------------------------------
@@ -812,8 +1212,13 @@ namespace {
     // ------- scene -----------------------------------------------------------
     rjDoc.AddMember("scene", 0, alloc);
 
-    // ------- scenes ----------------------------------------------------------
-    rj::Value rjSceneInstanceNodes(rj::kArrayType);
+    return rjDoc;
+  }
+
+  // Moves the top-level nodes into the scene, optionally below a node that rotates +Z to +Y
+  void addSceneRoots(Context& ctx, Model& model, rj::Value& rjSceneInstanceNodes, rj::Value& children)
+  {
+    rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
 
     if (ctx.rotateZToY) {
       //
@@ -827,10 +1232,6 @@ namespace {
       rotation.PushBack(0.f, alloc);
       rotation.PushBack(std::cos(-M_PI_4), alloc);
 
-      // Add file hierarchy below rotation node
-      rj::Value children(rj::kArrayType);
-      processChildren(ctx, model, children, firstNode, 0);
-
       // Add node to document
       rj::Value node(rj::kObjectType);
       node.AddMember("name", "rvmparser-rotate-z-to-y", alloc);
@@ -844,8 +1245,14 @@ namespace {
       rjSceneInstanceNodes.PushBack(nodeIndex, alloc);
     }
     else {
-      processChildren(ctx, model, rjSceneInstanceNodes, firstNode, 0);
+      rjSceneInstanceNodes.Swap(children);
     }
+  }
+
+  // Adds buffers, extensions and the gathered arrays of the model to the document
+  void endGLTF(Context& ctx, Model& model, rj::Document& rjDoc, rj::Value& rjSceneInstanceNodes)
+  {
+    rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = model.rjAlloc;
 
     // If we have a GLB container, add a single buffer that holds all data
     if (ctx.glbContainer) {
@@ -853,6 +1260,36 @@ namespace {
       rj::Value rjGlbBuffer(rj::kObjectType);
       rjGlbBuffer.AddMember("byteLength", model.dataBytes, alloc);
       model.rjBuffers.PushBack(rjGlbBuffer, alloc);
+
+      // Meshopt-compressed buffer views refer to a fallback buffer without data
+      if (model.usesMeshopt) {
+        rj::Value rjFallback(rj::kObjectType);
+        rjFallback.AddMember("fallback", true, alloc);
+
+        rj::Value rjExtensions(rj::kObjectType);
+        rjExtensions.AddMember("EXT_meshopt_compression", rjFallback, alloc);
+
+        rj::Value rjFallbackBuffer(rj::kObjectType);
+        rjFallbackBuffer.AddMember("byteLength", model.fallbackBytes, alloc);
+        rjFallbackBuffer.AddMember("extensions", rjExtensions, alloc);
+        model.rjBuffers.PushBack(rjFallbackBuffer, alloc);
+      }
+    }
+
+    // Both extensions are required, as there is no unquantized or uncompressed data
+    if (model.usesQuantization || model.usesMeshopt) {
+      rj::Value rjExtensionsUsed(rj::kArrayType);
+      rj::Value rjExtensionsRequired(rj::kArrayType);
+      if (model.usesQuantization) {
+        rjExtensionsUsed.PushBack("KHR_mesh_quantization", alloc);
+        rjExtensionsRequired.PushBack("KHR_mesh_quantization", alloc);
+      }
+      if (model.usesMeshopt) {
+        rjExtensionsUsed.PushBack("EXT_meshopt_compression", alloc);
+        rjExtensionsRequired.PushBack("EXT_meshopt_compression", alloc);
+      }
+      rjDoc.AddMember("extensionsUsed", rjExtensionsUsed, alloc);
+      rjDoc.AddMember("extensionsRequired", rjExtensionsRequired, alloc);
     }
 
 
@@ -868,7 +1305,23 @@ namespace {
     rjDoc.AddMember("accessors", model.rjAccessors, alloc);
     rjDoc.AddMember("bufferViews", model.rjBufferViews, alloc);
     rjDoc.AddMember("buffers", model.rjBuffers, alloc);
+  }
 
+  rj::Document buildGLTF(Context& ctx, Model& model, const Node* firstNode)
+  {
+    if (ctx.centerModel) {
+      calculateOrigin(ctx, model, firstNode);
+    }
+
+    rj::Document rjDoc = beginGLTF(ctx, model);
+
+    rj::Value children(rj::kArrayType);
+    processChildren(ctx, model, children, firstNode, 0);
+
+    rj::Value rjSceneInstanceNodes(rj::kArrayType);
+    addSceneRoots(ctx, model, rjSceneInstanceNodes, children);
+
+    endGLTF(ctx, model, rjDoc, rjSceneInstanceNodes);
     return rjDoc;
   }
 
@@ -905,7 +1358,6 @@ namespace {
     };
     if (fwrite(header, sizeof(header), 1, out) != 1) {
       ctx.logger(2, "%s: Error writing header", path);
-      fclose(out);
       return false;
     }
 
@@ -916,13 +1368,11 @@ namespace {
     };
     if (fwrite(jsonhunkHeader, sizeof(jsonhunkHeader), 1, out) != 1) {
       ctx.logger(2, "%s: Error writing JSON chunk header", path);
-      fclose(out);
       return false;
     }
 
     if (fwrite(buffer.GetString(), jsonByteSize, 1, out) != 1) {
       ctx.logger(2, "%s: Error writing JSON data", path);
-      fclose(out);
       return false;
     }
     if (jsonPaddingSize) {
@@ -930,7 +1380,6 @@ namespace {
       const char* padding = "   ";
       if (fwrite(padding, jsonPaddingSize, 1, out) != 1) {
         ctx.logger(2, "%s: Error writing JSON padding", path);
-        fclose(out);
         return false;
       }
     }
@@ -943,7 +1392,6 @@ namespace {
 
     if (fwrite(binChunkHeader, sizeof(binChunkHeader), 1, out) != 1) {
       ctx.logger(2, "%s: Error writing BIN chunk header", path);
-      fclose(out);
       return false;
     }
 
@@ -951,7 +1399,6 @@ namespace {
     for (DataItem* item = model.dataItems.first; item; item = item->next) {
       if (fwrite(item->ptr, item->size, 1, out) != 1) {
         ctx.logger(2, "%s: Error writing BIN chunk data at offset %u", path, offset);
-        fclose(out);
         return false;
       }
       offset += item->size;
@@ -964,16 +1411,62 @@ namespace {
     return true;
   }
 
-  bool writeAsGLTF(Context& ctx, FILE* out, const char* path, const rj::Document& rjDoc)
+  // JSON writer that replaces the uri of each buffer with a data uri holding the
+  // base64-encoding of the corresponding data item. The encoding is streamed to the file
+  // in chunks instead of being built in memory. Buffer uris are the strings that point at
+  // dataUriPrefix itself.
+  template<typename BaseWriter>
+  class DataUriWriter : public BaseWriter
+  {
+  public:
+    DataUriWriter(rj::FileWriteStream& os, FILE* out, std::vector<char>& tmp, const DataItem* items) :
+      BaseWriter(os), os(os), out(out), tmp(tmp), item(items)
+    {}
+
+    bool String(const char* str, rj::SizeType length, bool copy = false)
+    {
+      if (str != dataUriPrefix) {
+        return BaseWriter::String(str, length, copy);
+      }
+      assert(length == dataUriPrefixLength);
+      if (item == nullptr) return false;
+
+      // Let the writer emit separators and the opening quote, and then write the rest directly
+      if (!BaseWriter::RawValue("\"", 1, rj::kStringType)) return false;
+      os.Flush();
+      if (fwrite(dataUriPrefix, dataUriPrefixLength, 1, out) != 1) return false;
+
+      const size_t chunkSize = 3 * 0x4000;
+      tmp.resize(base64EncodedLength(chunkSize));
+      const uint8_t* data = static_cast<const uint8_t*>(item->ptr);
+      for (size_t o = 0; o < item->size; o += chunkSize) {
+        size_t n = std::min(chunkSize, item->size - o);
+        base64Encode(tmp.data(), data + o, n);
+        if (fwrite(tmp.data(), base64EncodedLength(n), 1, out) != 1) return false;
+      }
+      os.Put('"');
+
+      item = item->next;
+      return true;
+    }
+
+  private:
+    rj::FileWriteStream& os;
+    FILE* out;
+    std::vector<char>& tmp;
+    const DataItem* item;
+  };
+
+  bool writeAsGLTF(Context& ctx, const DataItem* dataItems, FILE* out, const char* path, const rj::Document& rjDoc)
   {
     std::vector<char> writeBuffer(0x10000);
     rj::FileWriteStream os(out, writeBuffer.data(), writeBuffer.size());
 #if RVMPARSER_GLTF_PRETTY_PRINT == 1
     // Pretty printer for debug purposes
-    rj::PrettyWriter<rj::FileWriteStream> writer(os);
+    DataUriWriter<rj::PrettyWriter<rj::FileWriteStream>> writer(os, out, ctx.tmpBase64, dataItems);
     writer.SetIndent(' ', 2);
 #else
-    rj::Writer<rj::FileWriteStream> writer(os);
+    DataUriWriter<rj::Writer<rj::FileWriteStream>> writer(os, out, ctx.tmpBase64, dataItems);
 #endif
     if (!rjDoc.Accept(writer)) {
       ctx.logger(2, "%s: Failed to write json", path);
@@ -982,12 +1475,8 @@ namespace {
     return true;
   }
 
-  bool processSubtree(Context& ctx, const char* path, const Node* firstNode)
+  FILE* openForWriting(Context& ctx, const char* path)
   {
-    Model model;
-
-    rj::Document rjDoc = buildGLTF(ctx, model, firstNode);
-
 #ifdef _WIN32
     FILE* out = nullptr;
     auto err = fopen_s(&out, path, "wb");
@@ -997,24 +1486,32 @@ namespace {
         buf[0] = '\0';
       }
       ctx.logger(2, "Failed to open %s for writing: %s", path, buf);
-      return false;
+      return nullptr;
     }
     assert(out);
 #else
     FILE* out = fopen(path, "w");
     if (out == nullptr) {
       ctx.logger(2, "Failed to open %s for writing.", path);
-      return false;
+      return nullptr;
     }
 #endif
+    return out;
+  }
 
+  bool writeModel(Context& ctx, Model& model, const char* path, const rj::Document& rjDoc)
+  {
+    FILE* out = openForWriting(ctx, path);
+    if (out == nullptr) {
+      return false;
+    }
 
     bool success = true;
     if (ctx.glbContainer) {
       success = writeAsGLB(ctx, model, out, path, rjDoc);
     }
     else {
-      success = writeAsGLTF(ctx, out, path, rjDoc);
+      success = writeAsGLTF(ctx, model.dataItems.first, out, path, rjDoc);
     }
 
     fclose(out);
@@ -1022,17 +1519,387 @@ namespace {
     return success;
   }
 
+  bool writeJson(Context& ctx, const char* path, const rj::Document& rjDoc)
+  {
+    FILE* out = openForWriting(ctx, path);
+    if (out == nullptr) {
+      return false;
+    }
+    bool success = writeAsGLTF(ctx, nullptr, out, path, rjDoc);
+    fclose(out);
+    return success;
+  }
+
+  bool processSubtree(Context& ctx, const char* path, const Node* firstNode, BBox3f& bounds)
+  {
+    Model model;
+
+    rj::Document rjDoc = buildGLTF(ctx, model, firstNode);
+    bounds = model.bounds;
+
+    return writeModel(ctx, model, path, rjDoc);
+  }
+
+  bool formatPath(Context& ctx, std::vector<char>& tmp, const char* format, const char* stem, size_t index, const char* suffix)
+  {
+    tmp.resize(1);
+    while (true) {
+      int n = snprintf(tmp.data(), tmp.size(), format, stem, index, suffix);
+      if (n < 0) {
+        ctx.logger(2, "exportGLTF: sprintf error");
+        return false;
+      }
+      if (static_cast<size_t>(n) < tmp.size()) {
+        return true;
+      }
+      tmp.resize(static_cast<size_t>(n) + 1);
+    }
+  }
+
+  // Strips the directory part of a path, as files are referenced relative to the json file
+  // that refers to them, which sits in the same directory.
+  const char* fileName(const char* path)
+  {
+    const char* name = path;
+    for (const char* c = path; *c != '\0'; c++) {
+      if (*c == '/' || *c == '\\') {
+        name = c + 1;
+      }
+    }
+    return name;
+  }
+
+  // Runs job(ctx, i) for i in [0, count) on a pool of threads, where each thread works on its
+  // own copy of ctx. Returns false and stops handing out jobs as soon as a job fails.
+  template<typename Job>
+  bool runConcurrently(const Context& ctx, size_t count, size_t threadCount, Job job)
+  {
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    const std::thread::id caller = std::this_thread::get_id();
+    auto worker = [&]()
+    {
+      Context local = ctx;
+      if (std::this_thread::get_id() != caller) {
+        traceThreadName("export worker");
+      }
+      while (!failed.load()) {
+        size_t i = next.fetch_add(1);
+        if (count <= i) break;
+        if (!job(local, i)) {
+          failed.store(true);
+          break;
+        }
+      }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threadCount; i++) {
+      pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : pool) {
+      thread.join();
+    }
+    return !failed.load();
+  }
+
+  size_t resolveThreadCount(size_t threads, size_t jobs)
+  {
+    size_t threadCount = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    return std::max(size_t(1), std::min(threadCount, jobs));
+  }
+
+  struct SplitPart
+  {
+    std::vector<char> path;
+    BBox3f bounds = createEmptyBBox3f();
+  };
+
+  // Writes a json file listing the produced files with their world-frame bounding boxes
+  bool writeSplitIndex(Context& ctx, const std::vector<SplitPart>& parts)
+  {
+    std::vector<char> path;
+    if (!formatPath(ctx, path, "%s%.0zu%s", ctx.path, 0, ".index.json")) {
+      return false;
+    }
+
+    rj::Document rjDoc(rj::kObjectType);
+    rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = rjDoc.GetAllocator();
+
+    rj::Value rjParts(rj::kArrayType);
+    for (size_t i = 0; i < parts.size(); i++) {
+      const SplitPart& part = parts[i];
+
+      rj::Value rjPart(rj::kObjectType);
+      rjPart.AddMember("uri", rj::Value(fileName(part.path.data()), alloc), alloc);
+      rjPart.AddMember("split", static_cast<uint64_t>(i), alloc);
+      if (isNotEmpty(part.bounds)) {
+        rj::Value rjMin(rj::kArrayType);
+        rj::Value rjMax(rj::kArrayType);
+        for (size_t k = 0; k < 3; k++) {
+          rjMin.PushBack(part.bounds.min.data[k], alloc);
+          rjMax.PushBack(part.bounds.max.data[k], alloc);
+        }
+        rjPart.AddMember("min", rjMin, alloc);
+        rjPart.AddMember("max", rjMax, alloc);
+      }
+      rjParts.PushBack(rjPart, alloc);
+    }
+    rjDoc.AddMember("splitLevel", static_cast<uint64_t>(ctx.split.level), alloc);
+    rjDoc.AddMember("parts", rjParts, alloc);
+
+    if (!writeJson(ctx, path.data(), rjDoc)) {
+      return false;
+    }
+    ctx.logger(0, "exportGLTF: Wrote index of %zu files to %s", parts.size(), path.data());
+    return true;
+  }
+
+  // ------- 3D Tiles --------------------------------------------------------
+
+  struct Tile
+  {
+    BBox3f bounds = createEmptyBBox3f();  // World bounds of content in this tile and its descendants
+    float geometricError = 0.f;
+    size_t itemsBegin = 0;                // Range of TilesContext::items that is content of this tile
+    size_t itemsEnd = 0;
+    std::vector<uint32_t> children;
+    std::vector<char> path;               // Path of content file, empty if tile has no content
+  };
+
+  struct TileItem
+  {
+    const Geometry* geo;
+    size_t code;    // Octant of child tile, or 8 if kept in the current tile
+  };
+
+  struct TilesContext
+  {
+    std::vector<TileItem> items;
+    std::vector<Tile> tiles;
+    size_t maxTriangles = 0;
+    unsigned maxDepth = 12;
+  };
+
+  size_t tileCost(const Geometry* geo)
+  {
+    return geo->kind == Geometry::Kind::Line ? 1 : geo->triangulation->triangles_n;
+  }
+
+  float tessellationError(const Geometry* geo)
+  {
+    return geo->kind == Geometry::Kind::Line ? 0.f : geo->triangulation->error;
+  }
+
+  // Recursively subdivides the octree cell, geometries that are large compared to the child
+  // cells or where the budget is already met stay in this tile. With additive refinement, a
+  // tile's geometric error is the size of the largest geometry that is missing if its
+  // descendants are not rendered, or the tessellation error of its own content.
+  uint32_t buildTile(TilesContext& tc, size_t begin, size_t end, const BBox3f& cell, unsigned depth, float& maxItemSize)
+  {
+    uint32_t tileIndex = static_cast<uint32_t>(tc.tiles.size());
+    tc.tiles.emplace_back();
+
+    size_t cost = 0;
+    BBox3f bounds = createEmptyBBox3f();
+    for (size_t i = begin; i < end; i++) {
+      const Geometry* geo = tc.items[i].geo;
+      engulf(bounds, geo->bboxWorld);
+      cost += tileCost(geo);
+      maxItemSize = std::max(maxItemSize, diagonal(geo->bboxWorld));
+    }
+
+    const Vec3f center = 0.5f * (cell.min + cell.max);
+    const float childSize = 0.5f * maxSideLength(cell);
+    size_t keep = end;
+    if (tc.maxTriangles < cost && depth < tc.maxDepth) {
+      for (size_t i = begin; i < end; i++) {
+        const BBox3f& b = tc.items[i].geo->bboxWorld;
+        if (0.5f * childSize < maxSideLength(b)) {
+          tc.items[i].code = 8;
+        }
+        else {
+          const Vec3f c = 0.5f * (b.min + b.max);
+          tc.items[i].code = (center.x < c.x ? 1 : 0) | (center.y < c.y ? 2 : 0) | (center.z < c.z ? 4 : 0);
+        }
+      }
+      std::sort(tc.items.begin() + begin, tc.items.begin() + end, [](const TileItem& a, const TileItem& b) { return ((a.code + 1) % 9) < ((b.code + 1) % 9); });
+      keep = begin;
+      while (keep < end && tc.items[keep].code == 8) keep++;
+    }
+
+    float contentError = 0.f;
+    for (size_t i = begin; i < keep; i++) {
+      contentError = std::max(contentError, tessellationError(tc.items[i].geo));
+    }
+
+    float childrenError = 0.f;
+    float childItemSize = 0.f;
+    for (size_t a = keep; a < end; ) {
+      size_t code = tc.items[a].code;
+      size_t b = a + 1;
+      while (b < end && tc.items[b].code == code) b++;
+
+      BBox3f childCell;
+      for (size_t k = 0; k < 3; k++) {
+        bool upper = (code >> k) & 1;
+        childCell.min.data[k] = upper ? center.data[k] : cell.min.data[k];
+        childCell.max.data[k] = upper ? cell.max.data[k] : center.data[k];
+      }
+      uint32_t child = buildTile(tc, a, b, childCell, depth + 1, childItemSize);
+      childrenError = std::max(childrenError, tc.tiles[child].geometricError);
+      tc.tiles[tileIndex].children.push_back(child);
+      a = b;
+    }
+
+    Tile& tile = tc.tiles[tileIndex];
+    tile.bounds = bounds;
+    tile.itemsBegin = begin;
+    tile.itemsEnd = keep;
+    tile.geometricError = std::max(std::max(contentError, childrenError), childItemSize);
+    return tileIndex;
+  }
+
+  rj::Value createBoundingVolume(const BBox3f& bounds, const Vec3f& origin, rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc)
+  {
+    const Vec3f center = 0.5f * (bounds.min + bounds.max) - origin;
+    const Vec3f halfSize = max(0.5f * (bounds.max - bounds.min), makeVec3f(1e-3f));
+
+    rj::Value rjBox(rj::kArrayType);
+    for (size_t k = 0; k < 3; k++) {
+      rjBox.PushBack(center.data[k], alloc);
+    }
+    for (size_t k = 0; k < 3; k++) {
+      for (size_t j = 0; j < 3; j++) {
+        rjBox.PushBack(j == k ? halfSize.data[k] : 0.f, alloc);
+      }
+    }
+
+    rj::Value rjBoundingVolume(rj::kObjectType);
+    rjBoundingVolume.AddMember("box", rjBox, alloc);
+    return rjBoundingVolume;
+  }
+
+  rj::Value createTileJson(const TilesContext& tc, uint32_t tileIndex, const Vec3f& origin, rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc)
+  {
+    const Tile& tile = tc.tiles[tileIndex];
+
+    rj::Value rjTile(rj::kObjectType);
+    rjTile.AddMember("boundingVolume", createBoundingVolume(tile.bounds, origin, alloc), alloc);
+    rjTile.AddMember("geometricError", tile.geometricError, alloc);
+    if (!tile.path.empty()) {
+      rj::Value rjContent(rj::kObjectType);
+      rjContent.AddMember("uri", rj::Value(fileName(tile.path.data()), alloc), alloc);
+      rjTile.AddMember("content", rjContent, alloc);
+    }
+    if (!tile.children.empty()) {
+      rj::Value rjChildren(rj::kArrayType);
+      for (uint32_t child : tile.children) {
+        rjChildren.PushBack(createTileJson(tc, child, origin, alloc), alloc);
+      }
+      rjTile.AddMember("children", rjChildren, alloc);
+    }
+    return rjTile;
+  }
+
+  bool writeTileset(Context& ctx, const TilesContext& tc, const char* path, const Vec3f& origin)
+  {
+    rj::Document rjDoc(rj::kObjectType);
+    rj::MemoryPoolAllocator<rj::CrtAllocator>& alloc = rjDoc.GetAllocator();
+
+    // Tile content is plain GLB, which 3D Tiles 1.0 only accepts through the
+    // 3DTILES_content_gltf extension while 1.1 supports it directly. Quantized and meshopt
+    // content declares its glTF extensions in the GLB itself.
+    rj::Value rjAsset(rj::kObjectType);
+    rjAsset.AddMember("version", "1.1", alloc);
+    rjAsset.AddMember("generator", "rvmparser", alloc);
+    rjDoc.AddMember("asset", rjAsset, alloc);
+
+    // Error of not rendering anything at all
+    rjDoc.AddMember("geometricError", diagonal(tc.tiles[0].bounds), alloc);
+
+    // Tile content is relative to origin to preserve float precision, the root transform
+    // (column-major) moves it back into place.
+    rj::Value rjTransform(rj::kArrayType);
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t r = 0; r < 4; r++) {
+        rjTransform.PushBack(c == r ? 1.0 : 0.0, alloc);
+      }
+    }
+    for (size_t r = 0; r < 3; r++) {
+      rjTransform.PushBack(static_cast<double>(origin.data[r]), alloc);
+    }
+    rjTransform.PushBack(1.0, alloc);
+
+    rj::Value rjRoot = createTileJson(tc, 0, origin, alloc);
+    rjRoot.AddMember("transform", rjTransform, alloc);
+    rjRoot.AddMember("refine", "ADD", alloc);
+    rjDoc.AddMember("root", rjRoot, alloc);
+
+    return writeJson(ctx, path, rjDoc);
+  }
+
+  // Builds a flat GLB holding the content of a single tile
+  bool processTile(Context& ctx, const TilesContext& tc, const Tile& tile, const Vec3f& origin)
+  {
+    Model model;
+    model.origin = origin;
+
+    rj::Document rjDoc = beginGLTF(ctx, model);
+
+    std::vector<GeometryItem>& geos = ctx.tmpGeos;
+    geos.clear();
+    for (size_t i = tile.itemsBegin; i < tile.itemsEnd; i++) {
+      const Geometry* geo = tc.items[i].geo;
+      size_t sortKey = (static_cast<size_t>(createOrGetColor(ctx, model, geo)) << 1) | (geo->kind == Geometry::Kind::Line ? 1 : 0);
+      geos.push_back({ .sortKey = sortKey, .geo = geo });
+    }
+
+    rj::Value rjNode(rj::kObjectType);
+    rj::Value rjNodeChildren(rj::kArrayType);
+    addGeometries(ctx, model, rjNode, rjNodeChildren, geos, true);
+    if (!rjNodeChildren.Empty()) {
+      rjNode.AddMember("children", rjNodeChildren, model.rjAlloc);
+    }
+    rj::Value children(rj::kArrayType);
+    children.PushBack(model.rjNodes.Size(), model.rjAlloc);
+    model.rjNodes.PushBack(rjNode, model.rjAlloc);
+
+    rj::Value rjSceneInstanceNodes(rj::kArrayType);
+    addSceneRoots(ctx, model, rjSceneInstanceNodes, children);
+    endGLTF(ctx, model, rjDoc, rjSceneInstanceNodes);
+
+    return writeModel(ctx, model, tile.path.data(), rjDoc);
+  }
+
+  void collectTileItems(TilesContext& tc, const Node* node)
+  {
+    for (const Node* child = node->children.first; child; child = child->next) {
+      collectTileItems(tc, child);
+    }
+    if (node->kind == Node::Kind::Group) {
+      for (const Geometry* geo = node->group.geometries.first; geo; geo = geo->next) {
+        if (geo->kind == Geometry::Kind::Line || geo->triangulation) {
+          tc.items.push_back({ .geo = geo, .code = 8 });
+        }
+      }
+    }
+  }
+
 }
 
 
-bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel, bool rotateZToY, bool centerModel, bool includeAttributes, bool mergeGeometries)
+bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel, bool rotateZToY, bool centerModel, bool includeAttributes, bool mergeGeometries, bool quantize, bool meshoptCompression, size_t threads)
 {
   Context ctx{
     .logger = logger,
     .centerModel = centerModel,
     .rotateZToY = rotateZToY,
     .includeAttributes = includeAttributes,
-    .mergeGeometries = mergeGeometries
+    .mergeGeometries = mergeGeometries,
+    .quantize = quantize,
+    .meshoptCompression = meshoptCompression
   };
   ctx.split.level = splitLevel;
 
@@ -1073,37 +1940,130 @@ bool exportGLTF(Store* store, Logger logger, const char* path, size_t splitLevel
   }
 
 
-  ctx.logger(0, "exportGLTF: rotate-z-to-y=%u center=%u attributes=%u",
+  if (ctx.meshoptCompression && !ctx.glbContainer) {
+    ctx.logger(1, "exportGLTF: Meshopt compression is only supported for GLB files, ignoring.");
+    ctx.meshoptCompression = false;
+  }
+
+  ctx.logger(0, "exportGLTF: rotate-z-to-y=%u center=%u attributes=%u quantize=%u meshopt=%u",
              ctx.rotateZToY ? 1 : 0,
              ctx.centerModel ? 1 : 0,
-             ctx.includeAttributes ? 1 : 0);
-  do {
-    ctx.split.index = 0;
-
-    std::vector<char> tmp(1);
-    const char* currentPath = path;
-    if (ctx.split.choose != 0) {
-      while (true) {
-        int n = snprintf(tmp.data(), tmp.size(), "%s%zu%s", ctx.path, ctx.split.choose, ctx.suffix);
-        if (n < 0) {
-          ctx.logger(2, "exportGLTF: sprintf error");
-          return false;
-        }
-        if (n < tmp.size()) {
-          currentPath = tmp.data();
-          break;
-        }
-        tmp.resize(n + 1);
-      }
+             ctx.includeAttributes ? 1 : 0,
+             ctx.quantize ? 1 : 0,
+             ctx.meshoptCompression ? 1 : 0);
+  // Each split is an independent file, so they can be built and written concurrently. Every
+  // worker holds at most one Model at a time, so the thread count also bounds memory usage.
+  const Node* firstRoot = store->getFirstRoot();
+  std::vector<SplitPart> parts(std::max(size_t(1), countSplits(ctx, firstRoot, 0)));
+  for (size_t i = 0; i < parts.size(); i++) {
+    // Zero precision prints nothing for index 0, so the first file gets the given path
+    if (!formatPath(ctx, parts[i].path, "%s%.0zu%s", ctx.path, i, ctx.suffix)) {
+      return false;
+    }
+  }
+
+  size_t threadCount = resolveThreadCount(threads, parts.size());
+  if (1 < parts.size()) {
+    ctx.logger(0, "exportGLTF: Writing %zu files using %zu threads", parts.size(), threadCount);
+  }
+
+  bool success = runConcurrently(ctx, parts.size(), threadCount, [&](Context& local, size_t choose)
+  {
+    TraceScope trace("exportGLTF file", parts[choose].path.data());
+    local.split.choose = choose;
+    local.split.index = 0;
+    if (!processSubtree(local, parts[choose].path.data(), firstRoot, parts[choose].bounds)) {
+      return false;
     }
+    local.logger(0, "exportGLTF: Wrote %s", parts[choose].path.data());
+    return true;
+  });
+  if (!success) {
+    return false;
+  }
+
+  if (ctx.split.level != 0 && !writeSplitIndex(ctx, parts)) {
+    return false;
+  }
+
+  return true;
+}
 
-    if (!processSubtree(ctx, currentPath, store->getFirstRoot())) {
+
+bool exportTiles(Store* store, Logger logger, const char* path, size_t maxTrianglesPerTile, bool quantize, bool meshoptCompression, size_t threads)
+{
+  Context ctx{
+    .logger = logger,
+    .centerModel = true,
+    .rotateZToY = true,         // 3D Tiles is z-up and glTF content is y-up
+    .includeAttributes = false,
+    .glbContainer = true,
+    .mergeGeometries = true,
+    .quantize = quantize,
+    .meshoptCompression = meshoptCompression
+  };
+
+  { // Tile content is named after the tileset json file
+    size_t n = strlen(path);
+    if (n < 5 || (std::tolower(path[n - 4]) != 'j') || (std::tolower(path[n - 3]) != 's') ||
+        (std::tolower(path[n - 2]) != 'o') || (std::tolower(path[n - 1]) != 'n') || path[n - 5] != '.')
+    {
+      ctx.logger(2, "exportTiles: Failed to recognize path suffix (.json) in string '%s'", path);
       return false;
     }
-    ctx.logger(0, "exportGLTF: Wrote %s", currentPath);
-    ctx.split.choose++;
-  } while (ctx.split.choose < ctx.split.index);
+    ctx.path = store->strings.intern(path, path + n - 5);
+    ctx.suffix = store->strings.intern(".glb");
+  }
+
+  TilesContext tc;
+  tc.maxTriangles = maxTrianglesPerTile;
+  for (const Node* root = store->getFirstRoot(); root; root = root->next) {
+    collectTileItems(tc, root);
+  }
+  if (tc.items.empty()) {
+    ctx.logger(2, "exportTiles: No tessellated geometry to export");
+    return false;
+  }
+
+  // Octree cells are cubes enclosing all geometry
+  BBox3f cell = createEmptyBBox3f();
+  for (const TileItem& item : tc.items) {
+    engulf(cell, item.geo->bboxWorld);
+  }
+  const Vec3f origin = 0.5f * (cell.min + cell.max);
+  cell = makeBBox3f(origin - makeVec3f(0.5f * maxSideLength(cell)),
+                    origin + makeVec3f(0.5f * maxSideLength(cell)));
+
+  float maxItemSize = 0.f;
+  buildTile(tc, 0, tc.items.size(), cell, 0, maxItemSize);
+
+  std::vector<uint32_t> contentTiles;
+  for (size_t i = 0; i < tc.tiles.size(); i++) {
+    Tile& tile = tc.tiles[i];
+    if (tile.itemsBegin < tile.itemsEnd) {
+      if (!formatPath(ctx, tile.path, "%s_%zu%s", ctx.path, i, ctx.suffix)) {
+        return false;
+      }
+      contentTiles.push_back(static_cast<uint32_t>(i));
+    }
+  }
 
+  size_t threadCount = resolveThreadCount(threads, contentTiles.size());
+  ctx.logger(0, "exportTiles: %zu geometries into %zu tiles, %zu with content, using %zu threads",
+             tc.items.size(), tc.tiles.size(), contentTiles.size(), threadCount);
 
+  bool success = runConcurrently(ctx, contentTiles.size(), threadCount, [&](Context& local, size_t i)
+  {
+    TraceScope trace("exportTiles tile", tc.tiles[contentTiles[i]].path.data());
+    return processTile(local, tc, tc.tiles[contentTiles[i]], origin);
+  });
+  if (!success) {
+    return false;
+  }
+
+  if (!writeTileset(ctx, tc, path, origin)) {
+    return false;
+  }
+  ctx.logger(0, "exportTiles: Wrote %s", path);
   return true;
 }
@@ -8,6 +8,7 @@
 
 ExportHsf::ExportHsf(const char* path) : m_modelKey(INVALID_KEY), m_savePath(path)
 {
+	traceGroups = true;
 	m_baseModel = new HBaseModel();
 	HC_Open_Segment_By_Key(m_baseModel->GetModelKey());
 	{
@@ -4,6 +4,7 @@
 #include <rapidjson/filewritestream.h>
 
 #include "Store.h"
+#include "Trace.h"
 #include "LinAlgOps.h"
 
 
@@ -79,6 +80,7 @@ bool exportJson(Store* store, Logger logger, const char* path)
         if (model->children.first) {
           rj::Value jModelChildren(rj::kArrayType);
           for (auto * group = model->children.first; group != nullptr; group = group->next) {
+            auto trace = traceGroup(group);
             process(alloc, jModelChildren, logger, group);
           }
           jModel.AddMember("children", jModelChildren, alloc);
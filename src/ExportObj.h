@@ -9,6 +9,8 @@ class ExportObj : public StoreVisitor
 public:
   bool groupBoundingBoxes = false;
 
+  ExportObj() { traceGroups = true; }
+
   ~ExportObj();
 
   bool open(const char* path_obj, const char* path_mtl);
@@ -1,63 +1,203 @@
 #include "Common.h"
 #include "Store.h"
+#include "Trace.h"
 
 #include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <cmath>
+#include <vector>
 
 namespace {
 
+  // Output is formatted into a block buffer that is written with fwrite when full. Floats are
+  // formatted like "%14.5f" without going through printf, see writeFloat.
+  constexpr size_t bufferSize = 1024 * 1024;
+  constexpr size_t maxItemSize = 64;  // Largest item written by the fast paths below
+
   struct Context {
     Store* store = nullptr;
     Logger logger = nullptr;
     FILE* out = nullptr;
+    std::vector<char> buffer;
+    size_t fill = 0;
+    bool writeError = false;
   };
 
+  void flush(Context* ctx)
+  {
+    if (ctx->fill && fwrite(ctx->buffer.data(), 1, ctx->fill, ctx->out) != ctx->fill) {
+      ctx->writeError = true;
+    }
+    ctx->fill = 0;
+  }
+
+  char* reserve(Context* ctx, size_t size)
+  {
+    if (bufferSize < ctx->fill + size) flush(ctx);
+    return ctx->buffer.data() + ctx->fill;
+  }
+
+  void writeChar(Context* ctx, char c)
+  {
+    *reserve(ctx, 1) = c;
+    ctx->fill++;
+  }
+
+  void writeString(Context* ctx, const char* str)
+  {
+    if (str == nullptr) str = "(null)";  // As printed by printf's %s
+    size_t length = std::strlen(str);
+    if (bufferSize < length) {
+      flush(ctx);
+      if (fwrite(str, 1, length, ctx->out) != length) ctx->writeError = true;
+      return;
+    }
+    std::memcpy(reserve(ctx, length), str, length);
+    ctx->fill += length;
+  }
+
+  void writeLine(Context* ctx, const char* str)
+  {
+    writeString(ctx, str);
+    writeChar(ctx, '\n');
+  }
+
+  // Writes the decimal digits of x right-aligned in a field of width characters, with an
+  // optional sign and fraction part appended, i.e. like printf's %*llu with extras.
+  char* formatUnsigned(char* dst, uint64_t x, unsigned width, bool negative, const char* fraction, unsigned fractionLength)
+  {
+    char digits[24];
+    unsigned n = 0;
+    do {
+      digits[n++] = static_cast<char>('0' + x % 10);
+      x = x / 10;
+    } while (x);
+
+    unsigned length = n + (negative ? 1 : 0) + fractionLength;
+    for (; length < width; length++) *dst++ = ' ';
+    if (negative) *dst++ = '-';
+    while (n) *dst++ = digits[--n];
+    for (unsigned i = 0; i < fractionLength; i++) *dst++ = fraction[i];
+    return dst;
+  }
+
+  // Appends x as "%14.5f" would format it. A float is m * 2^e with a 24-bit m, so when the
+  // value is below 2^40, x * 10^5 = m * 10^5 * 2^e is computed exactly in 64 bits, and the
+  // rounding to an integer uses the remainder to round ties to even like printf does.
+  // Larger values and inf/nan are rare and go through snprintf.
+  char* formatFloat(char* dst, float x)
+  {
+    if (!(std::fabs(x) < 1099511627776.f)) {  // 2^40, also catches nan
+      char tmp[maxItemSize];
+      int n = snprintf(tmp, sizeof(tmp), "%14.5f", x);
+      if (n < 0 || int(sizeof(tmp)) <= n) n = 0;
+      std::memcpy(dst, tmp, n);
+      return dst + n;
+    }
+
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bool negative = (bits >> 31) != 0;
+    int exponent = static_cast<int>((bits >> 23) & 0xFF);
+    uint64_t mantissa = bits & 0x7FFFFF;
+    if (exponent) mantissa |= 0x800000;
+    else exponent = 1;                     // Denormal
+    int shift = 150 - exponent;            // x = mantissa * 2^-shift
+
+    uint64_t integer = 0;
+    uint64_t scaledFraction = 0;           // Fraction part times 10^5
+    if (shift <= 0) {
+      integer = mantissa << -shift;
+    }
+    else if (shift < 64) {
+      integer = mantissa >> shift;
+      uint64_t remainder = (mantissa & ((uint64_t(1) << shift) - 1)) * 100000;  // < 2^41
+      scaledFraction = remainder >> shift;
+      uint64_t rest = remainder & ((uint64_t(1) << shift) - 1);
+      uint64_t half = uint64_t(1) << (shift - 1);
+      if (half < rest || (rest == half && (scaledFraction & 1))) scaledFraction++;
+      if (scaledFraction == 100000) {
+        integer++;
+        scaledFraction = 0;
+      }
+    }
+    // else x < 2^-40 which rounds to zero
+
+    char fraction[6];
+    fraction[0] = '.';
+    for (unsigned i = 5; 0 < i; i--) {
+      fraction[i] = static_cast<char>('0' + scaledFraction % 10);
+      scaledFraction = scaledFraction / 10;
+    }
+    return formatUnsigned(dst, integer, 14, negative, fraction, 6);
+  }
+
+  void writeFloats(Context* ctx, const float* values, unsigned count)
+  {
+    char* dst = reserve(ctx, count * maxItemSize + 1);
+    char* begin = dst;
+    for (unsigned i = 0; i < count; i++) {
+      dst = formatFloat(dst, values[i]);
+    }
+    *dst++ = '\n';
+    ctx->fill += dst - begin;
+  }
 
   void writeUint(Context* ctx, uint32_t x)
   {
-    fprintf(ctx->out, "%6u\n", x);
+    char* dst = reserve(ctx, maxItemSize);
+    char* end = formatUnsigned(dst, x, 6, false, nullptr, 0);
+    *end++ = '\n';
+    ctx->fill += end - dst;
   }
 
   void writeUint2(Context* ctx, uint32_t x, uint32_t y)
   {
-    fprintf(ctx->out, "%6u%6u\n", x, y);
+    char* dst = reserve(ctx, maxItemSize);
+    char* end = formatUnsigned(dst, x, 6, false, nullptr, 0);
+    end = formatUnsigned(end, y, 6, false, nullptr, 0);
+    *end++ = '\n';
+    ctx->fill += end - dst;
   }
 
   void writeVec2f(Context* ctx, float x, float y)
   {
-    fprintf(ctx->out, "%14.5f%14.5f\n", x, y);
+    const float values[2] = { x, y };
+    writeFloats(ctx, values, 2);
   }
 
   void writeVec3f(Context* ctx, float x, float y, float z)
   {
-    fprintf(ctx->out, "%14.5f%14.5f%14.5f\n", x, y, z);
+    const float values[3] = { x, y, z };
+    writeFloats(ctx, values, 3);
   }
 
   void writeVec3f(Context* ctx, const float* ptr)
   {
-    writeVec3f(ctx, ptr[0], ptr[1], ptr[2]);
+    writeFloats(ctx, ptr, 3);
   }
 
   void writeVec4f(Context* ctx, float x, float y, float z, float w)
   {
-    fprintf(ctx->out, "%14.5f%14.5f%14.5f%14.5f\n", x, y, z, w);
+    const float values[4] = { x, y, z, w };
+    writeFloats(ctx, values, 4);
   }
 
   void writeVec4f(Context* ctx, const float* ptr)
   {
-    writeVec4f(ctx, ptr[0], ptr[1], ptr[2], ptr[3]);
+    writeFloats(ctx, ptr, 4);
   }
 
   void writeVec5f(Context* ctx, float x, float y, float z, float w, float q)
   {
-    fprintf(ctx->out, "%14.5f%14.5f%14.5f%14.5f%14.5f\n", x, y, z, w, q);
+    const float values[5] = { x, y, z, w, q };
+    writeFloats(ctx, values, 5);
   }
 
   void writeChunkHeader(Context* ctx, const char* id, uint32_t unknown0 = 1, uint32_t unknown1 = 1)
   {
-    fputs(id, ctx->out);
-    fputc('\n', ctx->out);
+    writeLine(ctx, id);
     writeUint2(ctx, unknown0, unknown1);
   }
 
@@ -121,7 +261,7 @@ namespace {
     default:
       assert(false);
     }
-    fprintf(ctx->out, "%6u\n", kind);
+    writeUint(ctx, kind);
     for (size_t k = 0; k < 3; k++) {
       writeVec4f(ctx,
                  geometry->M_3x4.data[k + 0],
@@ -186,7 +326,7 @@ namespace {
                  geometry->cylinder.height);
       break;
     case Geometry::Kind::Sphere:
-      fflush(ctx->out);
+      flush(ctx);
       assert(false && "Unhandled primitive type 9");
       break;
     case Geometry::Kind::Line:
@@ -221,13 +361,13 @@ namespace {
   {
     assert(group->kind == Node::Kind::Group);
     writeChunkHeader(ctx, "CNTB");
-    fprintf(ctx->out, "%s\n", group->group.name);
+    writeLine(ctx, group->group.name);
    
     writeVec3f(ctx,
                1000.f * group->group.translation[0],
                1000.f * group->group.translation[1],
                1000.f * group->group.translation[2]);
-    fprintf(ctx->out, "%6u\n", group->group.material);
+    writeUint(ctx, group->group.material);
 
     for (Node* child = group->children.first; child; child = child->next) {
       writeGroup(ctx, child);
@@ -245,10 +385,10 @@ namespace {
     assert(model->kind == Node::Kind::Model);
     
     writeChunkHeader(ctx, "MODL");
-    fprintf(ctx->out, "%s\n%s\n",
-            model->model.project,
-            model->model.name);
+    writeLine(ctx, model->model.project);
+    writeLine(ctx, model->model.name);
     for (Node* group = model->children.first; group; group = group->next) {
+      auto trace = traceGroup(group);
       writeGroup(ctx, group);
     }
   }
@@ -258,11 +398,10 @@ namespace {
     assert(file->kind == Node::Kind::File);
 
     writeChunkHeader(ctx, "HEAD");
-    fprintf(ctx->out, "%s\n%s\n%s\n%s\n",
-            file->file.info,
-            file->file.note,
-            file->file.date,
-            file->file.user);
+    writeLine(ctx, file->file.info);
+    writeLine(ctx, file->file.note);
+    writeLine(ctx, file->file.date);
+    writeLine(ctx, file->file.user);
     for (Node* model = file->children.first; model; model = model->next) {
       writeModel(ctx, model);
     }
@@ -297,10 +436,15 @@ bool exportRev(Store* store, Logger logger, const char* path)
   }
 #endif
   logger(0, "exportRev: Writing %s...", path);
+  ctx.buffer.resize(bufferSize);
   for (Node* file = store->getFirstRoot(); file; file = file->next) {
     writeFile(&ctx, file);
   }
+  flush(&ctx);
+  if (fclose(ctx.out) != 0 || ctx.writeError) {
+    logger(2, "exportRev: Failed to write %s.", path);
+    return false;
+  }
   logger(0, "exportRev: Writing %s... done", path);
-  fclose(ctx.out);
   return true;
 }
\ No newline at end of file
@@ -0,0 +1,401 @@
+#include "Common.h"
+#include "Store.h"
+#include "Trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+  // Writes the binary format read by parseRVM. Every chunk header holds the absolute offset of
+  // the next chunk. Payload sizes are known up front, so the offsets are computed before a
+  // chunk is written and the output can stream through a block buffer without seeking. Note
+  // that for CNTB, the offset is of the first child and not of the matching CNTE.
+  constexpr size_t bufferSize = 1024 * 1024;
+
+  struct Context {
+    Store* store = nullptr;
+    Logger logger = nullptr;
+    FILE* out = nullptr;
+    std::vector<uint8_t> buffer;
+    size_t fill = 0;
+    uint64_t offset = 0;      // File offset of the start of buffer
+    bool writeError = false;
+  };
+
+  void flush(Context* ctx)
+  {
+    if (ctx->fill && fwrite(ctx->buffer.data(), 1, ctx->fill, ctx->out) != ctx->fill) {
+      ctx->writeError = true;
+    }
+    ctx->offset += ctx->fill;
+    ctx->fill = 0;
+  }
+
+  uint8_t* reserve(Context* ctx, size_t size)
+  {
+    assert(size <= bufferSize);
+    if (bufferSize < ctx->fill + size) flush(ctx);
+    return ctx->buffer.data() + ctx->fill;
+  }
+
+  uint64_t currentOffset(const Context* ctx)
+  {
+    return ctx->offset + ctx->fill;
+  }
+
+  void writeUint32BE(Context* ctx, uint32_t x)
+  {
+    uint8_t* dst = reserve(ctx, 4);
+    dst[0] = static_cast<uint8_t>(x >> 24);
+    dst[1] = static_cast<uint8_t>(x >> 16);
+    dst[2] = static_cast<uint8_t>(x >> 8);
+    dst[3] = static_cast<uint8_t>(x);
+    ctx->fill += 4;
+  }
+
+  // Converts count floats to big-endian in one go.
+  void writeFloatsBE(Context* ctx, const float* values, size_t count)
+  {
+    uint8_t* dst = reserve(ctx, 4 * count);
+    for (size_t i = 0; i < count; i++) {
+      uint32_t x;
+      std::memcpy(&x, &values[i], sizeof(x));
+      dst[4 * i + 0] = static_cast<uint8_t>(x >> 24);
+      dst[4 * i + 1] = static_cast<uint8_t>(x >> 16);
+      dst[4 * i + 2] = static_cast<uint8_t>(x >> 8);
+      dst[4 * i + 3] = static_cast<uint8_t>(x);
+    }
+    ctx->fill += 4 * count;
+  }
+
+  void writeFloatBE(Context* ctx, float x)
+  {
+    writeFloatsBE(ctx, &x, 1);
+  }
+
+  void writeBytes(Context* ctx, const void* data, size_t size)
+  {
+    auto* src = static_cast<const uint8_t*>(data);
+    while (size) {
+      size_t n = std::min(size, bufferSize);
+      std::memcpy(reserve(ctx, n), src, n);
+      ctx->fill += n;
+      src += n;
+      size -= n;
+    }
+  }
+
+  // Strings are stored as a word count followed by the zero-padded string. There is always
+  // at least one terminating zero.
+  uint32_t stringSize(const char* str)
+  {
+    return static_cast<uint32_t>(4 + 4 * ((str ? std::strlen(str) : 0) / 4 + 1));
+  }
+
+  void writeString(Context* ctx, const char* str)
+  {
+    size_t length = str ? std::strlen(str) : 0;
+    size_t words = length / 4 + 1;
+    writeUint32BE(ctx, static_cast<uint32_t>(words));
+    writeBytes(ctx, str, length);
+
+    size_t padding = 4 * words - length;
+    std::memset(reserve(ctx, padding), 0, padding);
+    ctx->fill += padding;
+  }
+
+  void writeChunkHeader(Context* ctx, const char* id, uint32_t payloadSize)
+  {
+    uint8_t* dst = reserve(ctx, 16);
+    for (size_t i = 0; i < 4; i++) {
+      dst[4 * i + 0] = 0;
+      dst[4 * i + 1] = 0;
+      dst[4 * i + 2] = 0;
+      dst[4 * i + 3] = static_cast<uint8_t>(id[i]);
+    }
+    ctx->fill += 16;
+    uint64_t next = currentOffset(ctx) + 8 + payloadSize;
+    writeUint32BE(ctx, static_cast<uint32_t>(next));  // Wraps for files beyond 4GB, as the offset field is 32 bits.
+    writeUint32BE(ctx, 1);
+  }
+
+  uint32_t primitiveKind(const Geometry* geo)
+  {
+    switch (geo->kind) {
+    case Geometry::Kind::Pyramid:           return 1;
+    case Geometry::Kind::Box:               return 2;
+    case Geometry::Kind::RectangularTorus:  return 3;
+    case Geometry::Kind::CircularTorus:     return 4;
+    case Geometry::Kind::EllipticalDish:    return 5;
+    case Geometry::Kind::SphericalDish:     return 6;
+    case Geometry::Kind::Snout:             return 7;
+    case Geometry::Kind::Cylinder:          return 8;
+    case Geometry::Kind::Sphere:            return 9;
+    case Geometry::Kind::Line:              return 10;
+    case Geometry::Kind::FacetGroup:        return 11;
+    default:
+      assert(false && "Illegal kind");
+      return 0;
+    }
+  }
+
+  uint32_t primitiveParameterSize(const Geometry* geo)
+  {
+    switch (geo->kind) {
+    case Geometry::Kind::Pyramid:           return 4 * 7;
+    case Geometry::Kind::Box:               return 4 * 3;
+    case Geometry::Kind::RectangularTorus:  return 4 * 4;
+    case Geometry::Kind::CircularTorus:     return 4 * 3;
+    case Geometry::Kind::EllipticalDish:    return 4 * 2;
+    case Geometry::Kind::SphericalDish:     return 4 * 2;
+    case Geometry::Kind::Snout:             return 4 * 9;
+    case Geometry::Kind::Cylinder:          return 4 * 2;
+    case Geometry::Kind::Sphere:            return 4 * 1;
+    case Geometry::Kind::Line:              return 4 * 2;
+    case Geometry::Kind::FacetGroup: {
+      uint32_t size = 4;
+      for (size_t p = 0; p < geo->facetGroup.polygons_n; p++) {
+        const Polygon& polygon = geo->facetGroup.polygons[p];
+        size += 4;
+        for (size_t c = 0; c < polygon.contours_n; c++) {
+          size += 4 + 4 * 6 * polygon.contours[c].vertices_n;
+        }
+      }
+      return size;
+    }
+    default:
+      assert(false && "Illegal kind");
+      return 0;
+    }
+  }
+
+  void writeGeometry(Context* ctx, const Geometry* geo)
+  {
+    const char* id = nullptr;
+    bool hasTransparency = false;
+    switch (geo->type) {
+    case Geometry::Type::Primitive:   id = "PRIM"; break;
+    case Geometry::Type::Obstruction: id = "OBST"; hasTransparency = true; break;
+    case Geometry::Type::Insulation:  id = "INSU"; hasTransparency = true; break;
+    default:
+      assert(false && "Invalid enum");
+      return;
+    }
+
+    uint32_t payloadSize = 4 + 4 + 4 * 12 + 4 * 6 + (hasTransparency ? 4 : 0) + primitiveParameterSize(geo);
+    writeChunkHeader(ctx, id, payloadSize);
+    writeUint32BE(ctx, 1);  // version
+    writeUint32BE(ctx, primitiveKind(geo));
+    writeFloatsBE(ctx, geo->M_3x4.data, 12);
+    writeFloatsBE(ctx, geo->bboxLocal.data, 6);
+    if (hasTransparency) {
+      uint8_t* dst = reserve(ctx, 4);
+      dst[0] = static_cast<uint8_t>(geo->transparency);
+      dst[1] = dst[2] = dst[3] = 0;
+      ctx->fill += 4;
+    }
+
+    switch (geo->kind) {
+    case Geometry::Kind::Pyramid:
+      writeFloatsBE(ctx, geo->pyramid.bottom, 2);
+      writeFloatsBE(ctx, geo->pyramid.top, 2);
+      writeFloatsBE(ctx, geo->pyramid.offset, 2);
+      writeFloatBE(ctx, geo->pyramid.height);
+      break;
+    case Geometry::Kind::Box:
+      writeFloatsBE(ctx, geo->box.lengths, 3);
+      break;
+    case Geometry::Kind::RectangularTorus:
+      writeFloatBE(ctx, geo->rectangularTorus.inner_radius);
+      writeFloatBE(ctx, geo->rectangularTorus.outer_radius);
+      writeFloatBE(ctx, geo->rectangularTorus.height);
+      writeFloatBE(ctx, geo->rectangularTorus.angle);
+      break;
+    case Geometry::Kind::CircularTorus:
+      writeFloatBE(ctx, geo->circularTorus.offset);
+      writeFloatBE(ctx, geo->circularTorus.radius);
+      writeFloatBE(ctx, geo->circularTorus.angle);
+      break;
+    case Geometry::Kind::EllipticalDish:
+      writeFloatBE(ctx, geo->ellipticalDish.baseRadius);
+      writeFloatBE(ctx, geo->ellipticalDish.height);
+      break;
+    case Geometry::Kind::SphericalDish:
+      writeFloatBE(ctx, geo->sphericalDish.baseRadius);
+      writeFloatBE(ctx, geo->sphericalDish.height);
+      break;
+    case Geometry::Kind::Snout:
+      writeFloatBE(ctx, geo->snout.radius_b);
+      writeFloatBE(ctx, geo->snout.radius_t);
+      writeFloatBE(ctx, geo->snout.height);
+      writeFloatsBE(ctx, geo->snout.offset, 2);
+      writeFloatsBE(ctx, geo->snout.bshear, 2);
+      writeFloatsBE(ctx, geo->snout.tshear, 2);
+      break;
+    case Geometry::Kind::Cylinder:
+      writeFloatBE(ctx, geo->cylinder.radius);
+      writeFloatBE(ctx, geo->cylinder.height);
+      break;
+    case Geometry::Kind::Sphere:
+      writeFloatBE(ctx, geo->sphere.diameter);
+      break;
+    case Geometry::Kind::Line:
+      writeFloatBE(ctx, geo->line.a);
+      writeFloatBE(ctx, geo->line.b);
+      break;
+    case Geometry::Kind::FacetGroup:
+      writeUint32BE(ctx, geo->facetGroup.polygons_n);
+      for (size_t p = 0; p < geo->facetGroup.polygons_n; p++) {
+        const Polygon& polygon = geo->facetGroup.polygons[p];
+        writeUint32BE(ctx, polygon.contours_n);
+        for (size_t c = 0; c < polygon.contours_n; c++) {
+          const Contour& contour = polygon.contours[c];
+          writeUint32BE(ctx, contour.vertices_n);
+          for (size_t v = 0; v < contour.vertices_n; v++) {
+            writeFloatsBE(ctx, contour.vertices + 3 * v, 3);
+            writeFloatsBE(ctx, contour.normals + 3 * v, 3);
+          }
+        }
+      }
+      break;
+    default:
+      assert(false && "Illegal kind");
+      break;
+    }
+  }
+
+  void writeGroup(Context* ctx, const Node* group, uint32_t inheritedTransparency)
+  {
+    assert(group->kind == Node::Kind::Group);
+
+    // Version 3 adds a transparency field, only use it when the group does not just inherit.
+    bool hasTransparency = group->group.transparency != inheritedTransparency;
+    uint32_t payloadSize = 4 + stringSize(group->group.name) + 4 * 3 + 4 + (hasTransparency ? 4 : 0);
+    writeChunkHeader(ctx, "CNTB", payloadSize);
+    writeUint32BE(ctx, hasTransparency ? 3 : 2);
+    writeString(ctx, group->group.name);
+    writeFloatBE(ctx, 1000.f * group->group.translation[0]);
+    writeFloatBE(ctx, 1000.f * group->group.translation[1]);
+    writeFloatBE(ctx, 1000.f * group->group.translation[2]);
+    writeUint32BE(ctx, group->group.material);
+    if (hasTransparency) {
+      uint8_t* dst = reserve(ctx, 4);
+      dst[0] = static_cast<uint8_t>(group->group.transparency);
+      dst[1] = dst[2] = dst[3] = 0;
+      ctx->fill += 4;
+    }
+
+    for (const Node* child = group->children.first; child; child = child->next) {
+      writeGroup(ctx, child, group->group.transparency);
+    }
+    for (const Geometry* geo = group->group.geometries.first; geo; geo = geo->next) {
+      writeGeometry(ctx, geo);
+    }
+
+    writeChunkHeader(ctx, "CNTE", 4);
+    writeUint32BE(ctx, 1);  // version
+  }
+
+  void writeColor(Context* ctx, const Color* color)
+  {
+    writeChunkHeader(ctx, "COLR", 4 + 4 + 4);
+    writeUint32BE(ctx, color->colorKind);
+    writeUint32BE(ctx, color->colorIndex);
+    uint8_t* dst = reserve(ctx, 4);
+    dst[0] = color->rgb[0];
+    dst[1] = color->rgb[1];
+    dst[2] = color->rgb[2];
+    dst[3] = 0;
+    ctx->fill += 4;
+  }
+
+  void writeModel(Context* ctx, const Node* model)
+  {
+    assert(model->kind == Node::Kind::Model);
+    writeChunkHeader(ctx, "MODL", 4 + stringSize(model->model.project) + stringSize(model->model.name));
+    writeUint32BE(ctx, 1);  // version
+    writeString(ctx, model->model.project);
+    writeString(ctx, model->model.name);
+
+    for (const Node* group = model->children.first; group; group = group->next) {
+      auto trace = traceGroup(group);
+      writeGroup(ctx, group, 0);
+    }
+    for (const Color* color = model->model.colors.first; color; color = color->next) {
+      writeColor(ctx, color);
+    }
+  }
+
+  void writeFile(Context* ctx, const Node* file)
+  {
+    assert(file->kind == Node::Kind::File);
+    writeChunkHeader(ctx, "HEAD", 4 + stringSize(file->file.info) + stringSize(file->file.note) +
+                                  stringSize(file->file.date) + stringSize(file->file.user) + stringSize(file->file.encoding));
+    writeUint32BE(ctx, 2);  // version, 2 includes encoding
+    writeString(ctx, file->file.info);
+    writeString(ctx, file->file.note);
+    writeString(ctx, file->file.date);
+    writeString(ctx, file->file.user);
+    writeString(ctx, file->file.encoding);
+
+    unsigned models = 0;
+    for (const Node* model = file->children.first; model; model = model->next) {
+      writeModel(ctx, model);
+      models++;
+    }
+    if (1 < models) {
+      ctx->logger(1, "exportRvm: File has %u models, readers usually only expect one.", models);
+    }
+    writeChunkHeader(ctx, "END:", 4);
+    writeUint32BE(ctx, 1);  // version
+  }
+
+}
+
+bool exportRvm(Store* store, Logger logger, const char* path)
+{
+  Context ctx;
+  ctx.store = store;
+  ctx.logger = logger;
+  ctx.out = nullptr;
+
+#ifdef _WIN32
+  auto err = fopen_s(&ctx.out, path, "wb");
+  if (err != 0) {
+    char buf[1024];
+    if (strerror_s(buf, sizeof(buf), err) != 0) {
+      buf[0] = '\0';
+    }
+    logger(2, "exportRvm: Failed to open %s for writing: %s", path, buf);
+    return false;
+  }
+  assert(ctx.out);
+#else
+  ctx.out = fopen(path, "wb");
+  if (ctx.out == nullptr) {
+    logger(2, "exportRvm: Failed to open %s for writing.", path);
+    return false;
+  }
+#endif
+  logger(0, "exportRvm: Writing %s...", path);
+  ctx.buffer.resize(bufferSize);
+  unsigned files = 0;
+  for (Node* file = store->getFirstRoot(); file; file = file->next) {
+    writeFile(&ctx, file);
+    files++;
+  }
+  if (1 < files) {
+    logger(1, "exportRvm: Wrote %u files after each other into %s, readers usually only expect one.", files, path);
+  }
+  flush(&ctx);
+  if (fclose(ctx.out) != 0 || ctx.writeError) {
+    logger(2, "exportRvm: Failed to write %s.", path);
+    return false;
+  }
+  logger(0, "exportRvm: Writing %s... done", path);
+  return true;
+}
@@ -64,6 +64,7 @@ void Flatten::populateSrcTags()
 {
   // Sets all group.index to ~0u, and records the tag-names in srcTags. Nothing is selected yet.
   // name of groups are already interned in srcGroup
+  srcTags.reserve(srcStore->groupCountAllocated());
   for (auto * srcRoot = srcStore->getFirstRoot(); srcRoot != nullptr; srcRoot = srcRoot->next) {
     for (auto * srcModel = srcRoot->children.first; srcModel != nullptr; srcModel = srcModel->next) {
       for (auto * srcGroup = srcModel->children.first; srcGroup != nullptr; srcGroup = srcGroup->next) {
@@ -118,6 +119,7 @@ void Flatten::buildPrunedCopyRecurse(Node* dstParent, Node* srcGroup, unsigned l
 Store* Flatten::run()
 {
   dstStore = new Store();
+  dstStore->copyArenaSettings(*srcStore);
 
   // populateSrcTags was run by the constructor, and setKeep and keepTags has changed some group.index from ~0u.
   // set group.index of parents of selected nodes to ~1u so we can retain them in the culling pass.
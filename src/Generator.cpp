@@ -0,0 +1,463 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+
+#include "Generator.h"
+#include "Store.h"
+#include "LinAlgOps.h"
+
+namespace {
+
+  const float pi = float(M_PI);
+  const float half_pi = float(0.5*M_PI);
+  const float twopi = float(2.0*M_PI);
+
+  // Leaves are laid out on a grid with this spacing in meters. The grid is kept close to a cube,
+  // so coordinates stay small enough for float precision to not get in the way of connect.
+  const float leafSpacing = 20.f;
+
+  const unsigned maxTemplates = 256;
+
+  struct Template
+  {
+    Node* group;
+    Vec3f origin;
+  };
+
+  struct Context
+  {
+    Store* store = nullptr;
+    Logger logger = nullptr;
+    const GeneratorOptions* options = nullptr;
+    uint32_t state = 1;
+    unsigned gridSide = 1;
+
+    std::vector<Template> templates;  // Leaves that repeated leaves copy from
+
+    unsigned leaves = 0;
+    unsigned primitives = 0;          // Geometries added to leaves of mixed primitives, selects the kind
+    unsigned pipeRuns = 0;
+    unsigned repeats = 0;
+    char buf[1024];
+  };
+
+  float random01(Context* ctx)
+  {
+    ctx->state = 1664525u * ctx->state + 1013904223u;
+    return static_cast<float>(ctx->state >> 8) * (1.f / 16777216.f);
+  }
+
+  float randomRange(Context* ctx, float a, float b)
+  {
+    return a + (b - a) * random01(ctx);
+  }
+
+  Mat3x4f makeTransform(const Vec3f& x, const Vec3f& y, const Vec3f& z, const Vec3f& t)
+  {
+    Mat3x4f M;
+    M.cols[0] = x;
+    M.cols[1] = y;
+    M.cols[2] = z;
+    M.cols[3] = t;
+    return M;
+  }
+
+  // Uniformly distributed rotation from a random unit quaternion (Shoemake).
+  Mat3x4f randomTransform(Context* ctx, const Vec3f& t)
+  {
+    float u0 = random01(ctx);
+    float u1 = twopi * random01(ctx);
+    float u2 = twopi * random01(ctx);
+    float a = std::sqrt(1.f - u0);
+    float b = std::sqrt(u0);
+    float qx = a * std::sin(u1);
+    float qy = a * std::cos(u1);
+    float qz = b * std::sin(u2);
+    float qw = b * std::cos(u2);
+    return makeTransform(makeVec3f(1.f - 2.f * (qy * qy + qz * qz), 2.f * (qx * qy + qw * qz), 2.f * (qx * qz - qw * qy)),
+                         makeVec3f(2.f * (qx * qy - qw * qz), 1.f - 2.f * (qx * qx + qz * qz), 2.f * (qy * qz + qw * qx)),
+                         makeVec3f(2.f * (qx * qz + qw * qy), 2.f * (qy * qz - qw * qx), 1.f - 2.f * (qx * qx + qy * qy)),
+                         t);
+  }
+
+  // Rotates local z onto d, which must be a unit vector in the xy-plane.
+  Mat3x4f alongTransform(const Vec3f& d, const Vec3f& t)
+  {
+    auto x = makeVec3f(-d.y, d.x, 0.f);
+    return makeTransform(x, cross(d, x), d, t);
+  }
+
+  BBox3f symmetricBBox(float x, float y, float z)
+  {
+    return makeBBox3f(makeVec3f(-x, -y, -z), makeVec3f(x, y, z));
+  }
+
+  Geometry* newGeometry(Context* ctx, Node* group, Geometry::Kind kind, const Mat3x4f& M, const BBox3f& bboxLocal)
+  {
+    auto * geo = ctx->store->newGeometry(group);
+    geo->kind = kind;
+    geo->M_3x4 = M;
+    geo->bboxLocal = bboxLocal;
+    geo->bboxWorld = transform(M, bboxLocal);
+    return geo;
+  }
+
+  // A stack of parallel regular polygons.
+  Geometry* addFacetGroup(Context* ctx, Node* group, const Mat3x4f& M, float size)
+  {
+    auto & arena = ctx->store->arena;
+    unsigned polygons_n = std::max(1u, ctx->options->facetPolygons);
+    unsigned vertices_n = std::max(3u, ctx->options->facetVertices);
+
+    auto * polygons = (Polygon*)arena.alloc(sizeof(Polygon) * polygons_n);
+    auto bbox = createEmptyBBox3f();
+    for (unsigned k = 0; k < polygons_n; k++) {
+      auto & poly = polygons[k];
+      poly.contours_n = 1;
+      poly.contours = (Contour*)arena.alloc(sizeof(Contour));
+
+      auto & contour = poly.contours[0];
+      contour.vertices_n = vertices_n;
+      contour.vertices = (float*)arena.alloc(3 * sizeof(float) * vertices_n);
+      contour.normals = (float*)arena.alloc(3 * sizeof(float) * vertices_n);
+
+      float r = size * randomRange(ctx, 0.25f, 0.5f);
+      float z = size * float(k) / float(polygons_n);
+      for (unsigned i = 0; i < vertices_n; i++) {
+        float theta = twopi * float(i) / float(vertices_n);
+        auto p = makeVec3f(r * std::cos(theta), r * std::sin(theta), z);
+        write(contour.vertices + 3 * i, p);
+        write(contour.normals + 3 * i, makeVec3f(0.f, 0.f, 1.f));
+        engulf(bbox, p);
+      }
+    }
+
+    auto * geo = newGeometry(ctx, group, Geometry::Kind::FacetGroup, M, bbox);
+    geo->facetGroup.polygons = polygons;
+    geo->facetGroup.polygons_n = polygons_n;
+    return geo;
+  }
+
+  // One geometry of the given kind with random parameters, placement and orientation.
+  void addPrimitive(Context* ctx, Node* group, Geometry::Kind kind, const Vec3f& origin)
+  {
+    float s = randomRange(ctx, 0.2f, 1.5f);
+    auto t = origin + makeVec3f(randomRange(ctx, 0.f, 10.f), randomRange(ctx, 0.f, 10.f), randomRange(ctx, 0.f, 10.f));
+    auto M = randomTransform(ctx, t);
+
+    Geometry* geo = nullptr;
+    switch (kind) {
+
+    case Geometry::Kind::Pyramid: {
+      float b[2] = { s * randomRange(ctx, 0.5f, 1.f), s * randomRange(ctx, 0.5f, 1.f) };
+      float f = randomRange(ctx, 0.f, 0.8f);
+      float o[2] = { s * randomRange(ctx, -0.25f, 0.25f), s * randomRange(ctx, -0.25f, 0.25f) };
+      geo = newGeometry(ctx, group, kind, M, symmetricBBox(0.5f * b[0] + 0.5f * std::abs(o[0]),
+                                                           0.5f * b[1] + 0.5f * std::abs(o[1]),
+                                                           0.5f * s));
+      geo->pyramid = { { b[0], b[1] }, { f * b[0], f * b[1] }, { o[0], o[1] }, s };
+      break;
+    }
+
+    case Geometry::Kind::Box: {
+      float l[3] = { s * randomRange(ctx, 0.2f, 1.f), s * randomRange(ctx, 0.2f, 1.f), s * randomRange(ctx, 0.2f, 1.f) };
+      geo = newGeometry(ctx, group, kind, M, symmetricBBox(0.5f * l[0], 0.5f * l[1], 0.5f * l[2]));
+      geo->box = { { l[0], l[1], l[2] } };
+      break;
+    }
+
+    // Angles are at most a quarter turn, so the swept section stays in the positive xy-quadrant.
+    case Geometry::Kind::RectangularTorus: {
+      float inner = s * randomRange(ctx, 0.2f, 0.6f);
+      float outer = inner + s * randomRange(ctx, 0.1f, 0.4f);
+      float h = s * randomRange(ctx, 0.1f, 0.5f);
+      geo = newGeometry(ctx, group, kind, M, makeBBox3f(makeVec3f(0.f, 0.f, -0.5f * h), makeVec3f(outer, outer, 0.5f * h)));
+      geo->rectangularTorus = { inner, outer, h, randomRange(ctx, pi / 6.f, half_pi) };
+      break;
+    }
+
+    case Geometry::Kind::CircularTorus: {
+      float r = s * randomRange(ctx, 0.05f, 0.2f);
+      float offset = r + s * randomRange(ctx, 0.2f, 0.6f);
+      geo = newGeometry(ctx, group, kind, M, makeBBox3f(makeVec3f(0.f, 0.f, -r), makeVec3f(offset + r, offset + r, r)));
+      geo->circularTorus = { offset, r, randomRange(ctx, pi / 6.f, half_pi) };
+      break;
+    }
+
+    case Geometry::Kind::EllipticalDish: {
+      float r = 0.5f * s;
+      float h = r * randomRange(ctx, 0.25f, 0.75f);
+      geo = newGeometry(ctx, group, kind, M, makeBBox3f(makeVec3f(-r, -r, 0.f), makeVec3f(r, r, h)));
+      geo->ellipticalDish = { r, h };
+      break;
+    }
+
+    case Geometry::Kind::SphericalDish: {
+      float r = 0.5f * s;
+      float h = r * randomRange(ctx, 0.25f, 1.f);
+      geo = newGeometry(ctx, group, kind, M, makeBBox3f(makeVec3f(-r, -r, 0.f), makeVec3f(r, r, h)));
+      geo->sphericalDish = { r, h };
+      break;
+    }
+
+    case Geometry::Kind::Snout: {
+      float rb = s * randomRange(ctx, 0.1f, 0.4f);
+      float rt = s * randomRange(ctx, 0.1f, 0.4f);
+      float o[2] = { s * randomRange(ctx, -0.2f, 0.2f), s * randomRange(ctx, -0.2f, 0.2f) };
+      float r = std::max(rb, rt);
+      geo = newGeometry(ctx, group, kind, M, symmetricBBox(r + 0.5f * std::abs(o[0]), r + 0.5f * std::abs(o[1]), 0.5f * s));
+      geo->snout = { { o[0], o[1] }, { 0.f, 0.f }, { 0.f, 0.f }, rb, rt, s };
+      break;
+    }
+
+    case Geometry::Kind::Cylinder: {
+      float r = s * randomRange(ctx, 0.05f, 0.3f);
+      geo = newGeometry(ctx, group, kind, M, symmetricBBox(r, r, 0.5f * s));
+      geo->cylinder = { r, s };
+      break;
+    }
+
+    case Geometry::Kind::Sphere:
+      geo = newGeometry(ctx, group, kind, M, symmetricBBox(0.5f * s, 0.5f * s, 0.5f * s));
+      geo->sphere = { s };
+      break;
+
+    case Geometry::Kind::Line:
+      geo = newGeometry(ctx, group, kind, M, makeBBox3f(makeVec3f(-0.5f * s, 0.f, 0.f), makeVec3f(0.5f * s, 0.f, 0.f)));
+      geo->line = { -0.5f * s, 0.5f * s };
+      break;
+
+    case Geometry::Kind::FacetGroup:
+      geo = addFacetGroup(ctx, group, M, s);
+      break;
+
+    default:
+      assert(false && "Illegal kind");
+      return;
+    }
+
+    if (ctx->primitives % 16 == 15) {
+      geo->type = Geometry::Type::Obstruction;
+      geo->transparency = 50;
+    }
+    ctx->primitives++;
+  }
+
+  // Straight pieces along the current direction in the xy-plane, joined by quarter-turn elbows
+  // and the odd reducer, capped by dishes at both ends. Each piece starts where the previous one
+  // ends and faces the opposite way, which is what connect looks for.
+  void addPipeRun(Context* ctx, Node* group, const Vec3f& origin)
+  {
+    float r = randomRange(ctx, 0.05f, 0.3f);
+    auto p = origin;
+    auto d = makeVec3f(1.f, 0.f, 0.f);
+
+    auto * start = newGeometry(ctx, group, Geometry::Kind::EllipticalDish, alongTransform(-1.f * d, p),
+                               makeBBox3f(makeVec3f(-r, -r, 0.f), makeVec3f(r, r, 0.5f * r)));
+    start->ellipticalDish = { r, 0.5f * r };
+
+    unsigned segments = std::max(1u, ctx->options->pipeSegments);
+    for (unsigned i = 0; i < segments; i++) {
+      float length = randomRange(ctx, 1.f, 4.f);
+      auto * cylinder = newGeometry(ctx, group, Geometry::Kind::Cylinder, alongTransform(d, p + (0.5f * length) * d),
+                                    symmetricBBox(r, r, 0.5f * length));
+      cylinder->cylinder = { r, length };
+      p = p + length * d;
+      if (i + 1 == segments) break;
+
+      if (random01(ctx) < 0.25f) {
+        float rt = std::max(0.02f, 0.75f * r);
+        float h = 2.f * r;
+        float rm = std::max(r, rt);
+        auto * reducer = newGeometry(ctx, group, Geometry::Kind::Snout, alongTransform(d, p + (0.5f * h) * d),
+                                     symmetricBBox(rm, rm, 0.5f * h));
+        reducer->snout = { { 0.f, 0.f }, { 0.f, 0.f }, { 0.f, 0.f }, r, rt, h };
+        p = p + h * d;
+        r = rt;
+      }
+
+      // The elbow starts at local (bend, 0, 0) facing -y and ends at (0, bend, 0) facing -x, so
+      // map y to the incoming direction and -x to the outgoing one.
+      auto e = random01(ctx) < 0.5f ? makeVec3f(-d.y, d.x, 0.f) : makeVec3f(d.y, -d.x, 0.f);
+      float bend = 1.5f * r;
+      auto * elbow = newGeometry(ctx, group, Geometry::Kind::CircularTorus,
+                                 makeTransform(-1.f * e, d, cross(-1.f * e, d), p + bend * e),
+                                 makeBBox3f(makeVec3f(0.f, 0.f, -r), makeVec3f(bend + r, bend + r, r)));
+      elbow->circularTorus = { bend, r, half_pi };
+      p = p + bend * (d + e);
+      d = e;
+    }
+
+    auto * end = newGeometry(ctx, group, Geometry::Kind::SphericalDish, alongTransform(d, p),
+                             makeBBox3f(makeVec3f(-r, -r, 0.f), makeVec3f(r, r, 0.5f * r)));
+    end->sphericalDish = { r, 0.5f * r };
+    ctx->pipeRuns++;
+  }
+
+  // Copies the geometries of an earlier leaf, moved to origin. Facet group data is shared.
+  void addRepeat(Context* ctx, Node* group, const Template& src, const Vec3f& origin)
+  {
+    auto shift = origin - src.origin;
+    for (auto * srcGeo = src.group->group.geometries.first; srcGeo; srcGeo = srcGeo->next) {
+      auto M = srcGeo->M_3x4;
+      M.cols[3] = M.cols[3] + shift;
+
+      auto * geo = newGeometry(ctx, group, srcGeo->kind, M, srcGeo->bboxLocal);
+      geo->type = srcGeo->type;
+      geo->transparency = srcGeo->transparency;
+      if (geo->kind == Geometry::Kind::FacetGroup) {
+        geo->facetGroup = srcGeo->facetGroup;
+      }
+      else {
+        std::memcpy(&geo->snout, &srcGeo->snout, sizeof(srcGeo->snout));
+      }
+    }
+    ctx->repeats++;
+  }
+
+  void addLeaf(Context* ctx, Node* group, const Vec3f& origin)
+  {
+    auto * options = ctx->options;
+    float r = random01(ctx);
+    if (r < options->repeatRate && !ctx->templates.empty()) {
+      auto index = std::min(size_t(random01(ctx) * ctx->templates.size()), ctx->templates.size() - 1);
+      addRepeat(ctx, group, ctx->templates[index], origin);
+      return;
+    }
+
+    if (r < options->repeatRate + options->pipeRate) {
+      addPipeRun(ctx, group, origin);
+    }
+    else {
+      for (unsigned i = 0; i < options->primitivesPerLeaf; i++) {
+        addPrimitive(ctx, group, Geometry::Kind(ctx->primitives % 11), origin);
+      }
+    }
+    if (ctx->templates.size() < maxTemplates) {
+      ctx->templates.push_back(Template{ group, origin });
+    }
+  }
+
+  const char* typeNames[] = { "SITE", "ZONE", "EQUI", "SUBE", "BRAN" };
+  const char* purposes[] = { "PIPE", "STRU", "EQUI", "HVAC", "ELEC" };
+
+  void addAttribute(Context* ctx, Node* group, const char* key, const char* val)
+  {
+    ctx->store->newAttribute(group, ctx->store->strings.intern(key))->val = ctx->store->strings.intern(val);
+  }
+
+  void addAttributes(Context* ctx, Node* group, const char* owner, unsigned level)
+  {
+    auto * buf = ctx->buf;
+    auto bufSize = sizeof(ctx->buf);
+    for (unsigned k = 0; k < ctx->options->attributesPerGroup; k++) {
+      switch (k) {
+      case 0:
+        addAttribute(ctx, group, "Name", group->group.name);
+        break;
+      case 1:
+        addAttribute(ctx, group, "Type", typeNames[std::min(level, 4u)]);
+        break;
+      case 2:
+        addAttribute(ctx, group, "Owner", owner);
+        break;
+      case 3:
+        snprintf(buf, bufSize, "E %.0fmm N %.0fmm U %.0fmm", 1000.f * group->group.translation[0],
+                 1000.f * group->group.translation[1], 1000.f * group->group.translation[2]);
+        addAttribute(ctx, group, "Position", buf);
+        break;
+      case 4:
+        addAttribute(ctx, group, "Purpose", purposes[ctx->state % 5]);
+        break;
+      case 5:
+        snprintf(buf, bufSize, "Synthetic %s at level %u", typeNames[std::min(level, 4u)], level);
+        addAttribute(ctx, group, "Description", buf);
+        break;
+      default: {
+        char key[32];
+        snprintf(key, sizeof(key), ":UDA%u", k - 6);
+        snprintf(buf, bufSize, "%u", unsigned(1000000.f * random01(ctx)));
+        addAttribute(ctx, group, key, buf);
+        break;
+      }
+      }
+    }
+  }
+
+  void addGroup(Context* ctx, Node* parent, const char* owner, unsigned index, unsigned level)
+  {
+    if (level == 0) {
+      snprintf(ctx->buf, sizeof(ctx->buf), "/SITE-%u", index);
+    }
+    else {
+      snprintf(ctx->buf, sizeof(ctx->buf), "%s/%u", owner, index);
+    }
+    auto * group = ctx->store->newNode(parent, Node::Kind::Group);
+    group->group.name = ctx->store->strings.intern(ctx->buf);
+
+    bool leaf = level == ctx->options->depth;
+    Vec3f origin = makeVec3f(0.f);
+    if (leaf) {
+      auto side = ctx->gridSide;
+      auto i = ctx->leaves++;
+      origin = leafSpacing * makeVec3f(float(i % side), float((i / side) % side), float(i / (side * side)));
+      write(group->group.translation, origin);
+      group->group.material = 1 + i % 16;
+    }
+    addAttributes(ctx, group, owner, level);
+
+    if (leaf) {
+      addLeaf(ctx, group, origin);
+    }
+    else {
+      for (unsigned i = 0; i < ctx->options->width; i++) {
+        addGroup(ctx, group, group->group.name, i, level + 1);
+      }
+    }
+  }
+
+}
+
+void generateModel(Store* store, Logger logger, const GeneratorOptions& options)
+{
+  Context ctx;
+  ctx.store = store;
+  ctx.logger = logger;
+  ctx.options = &options;
+  ctx.state = options.seed;
+
+  double leaves = options.sites * std::pow(double(options.width), double(options.depth));
+  ctx.gridSide = std::max(1u, unsigned(std::ceil(std::cbrt(leaves))));
+
+  auto * file = store->newNode(nullptr, Node::Kind::File);
+  file->file.info = store->strings.intern("Synthetic model");
+  snprintf(ctx.buf, sizeof(ctx.buf), "seed=%u", options.seed);
+  file->file.note = store->strings.intern(ctx.buf);
+  file->file.date = store->strings.intern("");
+  file->file.user = store->strings.intern("");
+  file->file.encoding = store->strings.intern("");
+
+  auto * model = store->newNode(file, Node::Kind::Model);
+  model->model.project = store->strings.intern("SYNTHETIC");
+  model->model.name = store->strings.intern("/SYNTHETIC");
+
+  for (unsigned i = 0; i < options.sites; i++) {
+    addGroup(&ctx, model, model->model.name, i, 0);
+  }
+  store->updateCounts();
+
+  logger(0, "generateModel: %u leaves, %u pipe runs, %u repeated leaves, %u groups, %u geometries",
+         ctx.leaves, ctx.pipeRuns, ctx.repeats, store->groupCount_(), store->geometryCount_());
+}
+
+unsigned generatorSitesForGeometries(const GeneratorOptions& options, size_t geometries)
+{
+  // Pipe runs hold about two geometries per segment, repeated leaves are like the rest.
+  double perLeaf = (1.0 - options.pipeRate) * options.primitivesPerLeaf + options.pipeRate * 2.0 * options.pipeSegments;
+  double leavesPerSite = std::pow(double(options.width), double(options.depth));
+  return std::max(1u, unsigned(std::ceil(double(geometries) / (std::max(1.0, perLeaf) * leavesPerSite))));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include "Common.h"
+
+// Shape of a synthetic model, see generateModel.
+struct GeneratorOptions
+{
+  uint32_t seed = 1;
+  unsigned sites = 2;                 // Groups directly below the model
+  unsigned depth = 3;                 // Levels of groups below a site, geometry is in the last level
+  unsigned width = 4;                 // Children per group
+  unsigned primitivesPerLeaf = 12;    // Geometries per leaf group that is not a pipe run
+  unsigned facetPolygons = 8;         // Polygons per facet group
+  unsigned facetVertices = 6;         // Vertices per facet group polygon
+  float repeatRate = 0.25f;           // Fraction of leaves that repeat an earlier leaf at another position
+  float pipeRate = 0.25f;             // Fraction of leaves holding a run of connected pipe primitives
+  unsigned pipeSegments = 8;          // Straight pieces per pipe run, joined by elbows and reducers
+  unsigned attributesPerGroup = 4;
+};
+
+// Adds a file with a single model of sites * width^depth leaf groups to store, with names and
+// attributes on every group, so it can be written with exportRvm and exportAtt as a benchmark
+// input of any size. Leaves mix all eleven primitive kinds, or hold pipe runs whose ends touch
+// so that connect and align find work. The same seed gives the same model.
+void generateModel(Store* store, Logger logger, const GeneratorOptions& options);
+
+// Number of sites that gives a model of about the given number of geometries, with the other
+// options as they are.
+unsigned generatorSitesForGeometries(const GeneratorOptions& options, size_t geometries);
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+#include "Instrumentation.h"
+#include "Trace.h"
+
+void Instrumentation::addStage(const char* name, double milliseconds)
+{
+  // Names of fused stages are built at run time, keep a copy.
+  name = (const char*)names.dup(name, strlen(name) + 1);
+  stages.push_back(Stage{ name, milliseconds });
+}
+
+void Instrumentation::addCounter(const char* stage, const char* name, uint64_t value)
+{
+  counters.push_back(Counter{ stage, name, value });
+}
+
+bool Instrumentation::writeJson(Logger logger, const char* path) const
+{
+#ifdef _WIN32
+  FILE* out = nullptr;
+  auto err = fopen_s(&out, path, "w");
+  if (err != 0) {
+    char buf[256];
+    if (strerror_s(buf, sizeof(buf), err) != 0) {
+      buf[0] = '\0';
+    }
+    logger(2, "Failed to open %s for writing: %s", path, buf);
+    return false;
+  }
+  assert(out);
+#else
+  FILE* out = fopen(path, "w");
+  if (out == nullptr) {
+    logger(2, "Failed to open %s for writing.", path);
+    return false;
+  }
+#endif
+
+  // Stage and counter names are identifiers chosen in the code, so they need no escaping.
+  fprintf(out, "{\n  \"stages\": [\n");
+  for (size_t i = 0; i < stages.size(); i++) {
+    fprintf(out, "    { \"name\": \"%s\", \"ms\": %.3f }%s\n",
+            stages[i].name, stages[i].milliseconds, i + 1 < stages.size() ? "," : "");
+  }
+  fprintf(out, "  ],\n  \"counters\": [\n");
+  for (size_t i = 0; i < counters.size(); i++) {
+    fprintf(out, "    { \"stage\": \"%s\", \"name\": \"%s\", \"value\": %llu }%s\n",
+            counters[i].stage, counters[i].name, (unsigned long long)counters[i].value, i + 1 < counters.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+
+  bool rv = ferror(out) == 0;
+  if (fclose(out) != 0) rv = false;
+  if (!rv) {
+    logger(2, "Failed to write %s", path);
+  }
+  return rv;
+}
+
+ScopedTimer::ScopedTimer(Instrumentation* instrumentation, const char* stage) :
+  instrumentation(instrumentation),
+  stage(stage),
+  time0(std::chrono::high_resolution_clock::now())
+{
+}
+
+long long ScopedTimer::stop()
+{
+  if (elapsed < 0) {
+    auto duration = std::chrono::high_resolution_clock::now() - time0;
+    elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    if (instrumentation) {
+      instrumentation->addStage(stage, std::chrono::duration<double, std::milli>(duration).count());
+    }
+    if (traceActive) {
+      traceSpan(stage, nullptr, time0);
+    }
+  }
+  return elapsed;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include "Common.h"
+
+// Wall clock time of each pipeline stage and named counters reported by the stages, collected
+// over a run so they can be written out in a machine-readable form.
+struct Instrumentation
+{
+  struct Stage
+  {
+    const char* name;
+    double milliseconds;
+  };
+
+  struct Counter
+  {
+    const char* stage;
+    const char* name;
+    uint64_t value;
+  };
+
+  std::vector<Stage> stages;
+  std::vector<Counter> counters;
+  Arena names;
+
+  void addStage(const char* name, double milliseconds);
+  void addCounter(const char* stage, const char* name, uint64_t value);
+
+  bool writeJson(Logger logger, const char* path) const;
+};
+
+// Times a stage from construction until stop() or destruction, whichever comes first, and
+// records it in instrumentation if that is not null.
+class ScopedTimer
+{
+public:
+  ScopedTimer(Instrumentation* instrumentation, const char* stage);
+  ~ScopedTimer() { stop(); }
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  // Returns elapsed milliseconds, only the first call records the stage.
+  long long stop();
+
+private:
+  Instrumentation* instrumentation;
+  const char* stage;
+  std::chrono::high_resolution_clock::time_point time0;
+  long long elapsed = -1;
+};
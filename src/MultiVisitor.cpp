@@ -0,0 +1,106 @@
+#include <cassert>
+#include "MultiVisitor.h"
+
+void MultiVisitor::add(StoreVisitor* visitor)
+{
+  assert(visitors_n < maxVisitors);
+  visitors[visitors_n++] = visitor;
+  traceGroups = traceGroups || visitor->traceGroups;
+}
+
+void MultiVisitor::init(class Store& store)
+{
+  active_n = visitors_n;
+  for (unsigned i = 0; i < active_n; i++) {
+    active[i] = visitors[i];
+    active[i]->init(store);
+  }
+}
+
+bool MultiVisitor::done()
+{
+  // Drop finished visitors while keeping the order of the remaining ones.
+  unsigned n = 0;
+  for (unsigned i = 0; i < active_n; i++) {
+    if (!active[i]->done()) {
+      active[n++] = active[i];
+    }
+  }
+  active_n = n;
+  return active_n == 0;
+}
+
+void MultiVisitor::beginFile(struct Node* group)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->beginFile(group);
+}
+
+void MultiVisitor::endFile()
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->endFile();
+}
+
+void MultiVisitor::beginModel(struct Node* group)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->beginModel(group);
+}
+
+void MultiVisitor::endModel()
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->endModel();
+}
+
+void MultiVisitor::beginGroup(struct Node* group)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->beginGroup(group);
+}
+
+void MultiVisitor::doneGroupContents(struct Node* group)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->doneGroupContents(group);
+}
+
+void MultiVisitor::EndGroup()
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->EndGroup();
+}
+
+void MultiVisitor::beginChildren(struct Node* container)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->beginChildren(container);
+}
+
+void MultiVisitor::endChildren()
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->endChildren();
+}
+
+void MultiVisitor::beginAttributes(struct Node* container)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->beginAttributes(container);
+}
+
+void MultiVisitor::attribute(const char* key, const char* val)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->attribute(key, val);
+}
+
+void MultiVisitor::endAttributes(struct Node* container)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->endAttributes(container);
+}
+
+void MultiVisitor::beginGeometries(struct Node* container)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->beginGeometries(container);
+}
+
+void MultiVisitor::geometry(struct Geometry* geometry)
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->geometry(geometry);
+}
+
+void MultiVisitor::endGeometries()
+{
+  for (unsigned i = 0; i < active_n; i++) active[i]->endGeometries();
+}
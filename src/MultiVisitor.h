@@ -0,0 +1,56 @@
+#pragma once
+
+#include "StoreVisitor.h"
+
+// Dispatches a single traversal of the store to several visitors, so passes that do not depend
+// on each other's results within a group share one walk over the node and geometry graph. For
+// each callback the visitors are invoked in the order they were added. A visitor that needs
+// more than one pass keeps getting callbacks until its done() returns true. Group trace spans
+// are recorded if any of the visitors asks for them.
+class MultiVisitor : public StoreVisitor
+{
+public:
+  static constexpr unsigned maxVisitors = 8;
+
+  void add(StoreVisitor* visitor);
+
+  void init(class Store& store) override;
+
+  bool done() override;
+
+  void beginFile(struct Node* group) override;
+
+  void endFile() override;
+
+  void beginModel(struct Node* group) override;
+
+  void endModel() override;
+
+  void beginGroup(struct Node* group) override;
+
+  void doneGroupContents(struct Node* group) override;
+
+  void EndGroup() override;
+
+  void beginChildren(struct Node* container) override;
+
+  void endChildren() override;
+
+  void beginAttributes(struct Node* container) override;
+
+  void attribute(const char* key, const char* val) override;
+
+  void endAttributes(struct Node* container) override;
+
+  void beginGeometries(struct Node* container) override;
+
+  void geometry(struct Geometry* geometry) override;
+
+  void endGeometries() override;
+
+private:
+  StoreVisitor* visitors[maxVisitors];
+  unsigned visitors_n = 0;    // Visitors added
+  StoreVisitor* active[maxVisitors];
+  unsigned active_n = 0;      // Visitors not yet done, in the order they were added
+};
@@ -60,24 +60,34 @@ namespace {
     uint32_t len;
     curr_ptr = read_uint32_be(len, curr_ptr, end_ptr);
 
-    unsigned l = 4 * len;
-    for (unsigned i = 0; i < l; i++) {
+    size_t l = 4 * size_t(len);
+    for (size_t i = 0; i < l; i++) {
       if (curr_ptr[i] == 0) {
         l = i;
         break;
       }
     }
     *dst = store->strings.intern(curr_ptr, curr_ptr + l);
-    return curr_ptr + 4 * len;
+    return curr_ptr + 4 * size_t(len);
   }
 
-  const char* parse_chunk_header(char* id, uint32_t& next_chunk_offset, uint32_t& dunno, const char* curr_ptr, const char* end_ptr)
+  // Chunk headers store the absolute offset of the next chunk in 32 bits, which wraps in files
+  // larger than 4GB. No chunk payload comes close to 4GB, so the offset is the first position at
+  // or after the header with the stored low 32 bits.
+  uint64_t unwrap_offset(uint64_t position, uint32_t offset32)
+  {
+    uint64_t offset = (position & ~uint64_t(0xffffffffu)) | offset32;
+    if (offset < position) offset += uint64_t(1) << 32;
+    return offset;
+  }
+
+  const char* parse_chunk_header(char* id, uint64_t& next_chunk_offset, uint32_t& dunno, const char* base_ptr, const char* curr_ptr, const char* end_ptr)
   {
       if (curr_ptr >= end_ptr) 
       {
           id[0] = id[1] = id[2] = id[3] = ' ';
           id[4] = 0;
-          next_chunk_offset = ~0u;
+          next_chunk_offset = ~uint64_t(0);
           dunno = ~0u;
           return curr_ptr;
       }
@@ -86,7 +96,7 @@ namespace {
       {
           id[0] = id[1] = id[2] = id[3] = ' ';
           id[4] = 0;
-          next_chunk_offset = ~0u;
+          next_chunk_offset = ~uint64_t(0);
           dunno = ~0u;
           return curr_ptr;
       }
@@ -103,11 +113,13 @@ namespace {
       id[i] = ' ';
     }
     if (curr_ptr + 8 <= end_ptr) {
-      curr_ptr = read_uint32_be(next_chunk_offset, curr_ptr, end_ptr);
+      uint32_t offset32;
+      curr_ptr = read_uint32_be(offset32, curr_ptr, end_ptr);
       curr_ptr = read_uint32_be(dunno, curr_ptr, end_ptr);
+      next_chunk_offset = unwrap_offset(uint64_t(curr_ptr - base_ptr), offset32);
     }
     else {
-      next_chunk_offset = ~0u;
+      next_chunk_offset = ~uint64_t(0);
       dunno = ~0u;
       fprintf(stderr, "Chunk '%s' EOF after %zd bytes\n", id, end_ptr - curr_ptr);
       curr_ptr = end_ptr;
@@ -115,21 +127,21 @@ namespace {
     return curr_ptr;
   }
 
-  bool verifyOffset(Context* ctx, const char* chunk_type, const char* base_ptr, const char* curr_ptr, uint32_t expected_next_chunk_offset)
+  bool verifyOffset(Context* ctx, const char* chunk_type, const char* base_ptr, const char* curr_ptr, uint64_t expected_next_chunk_offset)
   {
-    size_t current_offset = curr_ptr - base_ptr;
-    if (static_cast<uint32_t>(current_offset) == expected_next_chunk_offset) {
+    uint64_t current_offset = uint64_t(curr_ptr - base_ptr);
+    if (current_offset == expected_next_chunk_offset) {
       return true;
     }
     else {
-      snprintf(ctx->buf, ctx->buf_size, "After chunk %s, expected offset %#x, current offset is %#zx",
-               chunk_type, expected_next_chunk_offset, current_offset);
+      snprintf(ctx->buf, ctx->buf_size, "After chunk %s, expected offset %#llx, current offset is %#llx",
+               chunk_type, (unsigned long long)expected_next_chunk_offset, (unsigned long long)current_offset);
       ctx->store->setErrorString(ctx->buf);
       return false;
     }
   }
 
-  const char* parse_head(Context* ctx, const char* path, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t expected_next_chunk_offset)
+  const char* parse_head(Context* ctx, const char* path, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint64_t expected_next_chunk_offset)
   {
     assert(ctx->group_stack.empty());
     auto * g = ctx->store->newNode(nullptr, Node::Kind::File);
@@ -154,7 +166,7 @@ namespace {
     return curr_ptr;
   }
 
-  const char* parse_modl(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t expected_next_chunk_offset)
+  const char* parse_modl(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint64_t expected_next_chunk_offset)
   {
     assert(!ctx->group_stack.empty());
     auto * g = ctx->store->newNode(ctx->group_stack.back(), Node::Kind::Model);
@@ -173,7 +185,7 @@ namespace {
     return curr_ptr;
   }
 
-  const char* parse_prim(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t chunk_id, uint32_t expected_next_chunk_offset)
+  const char* parse_prim(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t chunk_id, uint64_t expected_next_chunk_offset)
   {
     assert(!ctx->group_stack.empty());
     Node* parent = ctx->group_stack.back();
@@ -345,7 +357,7 @@ namespace {
     return curr_ptr;
   }
 
-  const char* parse_cntb(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t expected_next_chunk_offset)
+  const char* parse_cntb(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint64_t expected_next_chunk_offset)
   {
     assert(!ctx->group_stack.empty());
     Node* parent = ctx->group_stack.back();
@@ -393,7 +405,7 @@ namespace {
     char chunk_id[5] = { 0, 0, 0, 0, 0 };
     auto l = curr_ptr;
     uint32_t dunno;
-    curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+    curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, base_ptr, curr_ptr, end_ptr);
     uint32_t id_chunk_id = id(chunk_id);
     while (curr_ptr < end_ptr && id_chunk_id != id("CNTE")) {
       switch (id_chunk_id) {
@@ -413,7 +425,7 @@ namespace {
         return nullptr;
       }
       l = curr_ptr;
-      curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+      curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, base_ptr, curr_ptr, end_ptr);
       id_chunk_id = id(chunk_id);
     }
 
@@ -428,7 +440,7 @@ namespace {
     return curr_ptr;
   }
 
-  const char* parse_colr(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint32_t expected_next_chunk_offset) {
+  const char* parse_colr(Context* ctx, const char* base_ptr, const char* curr_ptr, const char* end_ptr, uint64_t expected_next_chunk_offset) {
     assert(!ctx->group_stack.empty());
     if (ctx->group_stack.back()->kind != Node::Kind::Model) {
       ctx->store->setErrorString("Model chunk unfinished.");
@@ -463,11 +475,12 @@ bool parseRVM(class Store* store, Logger logger, const char* path, const void *
   const char* curr_ptr = base_ptr;
   const char* end_ptr = curr_ptr + size;
 
-  uint32_t expected_next_chunk_offset, dunno;
+  uint64_t expected_next_chunk_offset;
+  uint32_t dunno;
 
 
   char chunk_id[5] = { 0, 0, 0, 0, 0 };
-  curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+  curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, base_ptr, curr_ptr, end_ptr);
   if (id(chunk_id) != id("HEAD")) {
     snprintf(ctx.buf, ctx.buf_size, "Expected chunk HEAD, got %s", chunk_id);
     store->setErrorString(buf);
@@ -476,7 +489,7 @@ bool parseRVM(class Store* store, Logger logger, const char* path, const void *
   curr_ptr = parse_head(&ctx, path, base_ptr, curr_ptr, end_ptr, expected_next_chunk_offset);
   if (curr_ptr == nullptr) return false;
 
-  curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+  curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, base_ptr, curr_ptr, end_ptr);
   if (id(chunk_id) != id("MODL")) {
     snprintf(ctx.buf, ctx.buf_size, "Expected chunk MODL, got %s",chunk_id);
     store->setErrorString(buf);
@@ -485,7 +498,7 @@ bool parseRVM(class Store* store, Logger logger, const char* path, const void *
   curr_ptr = parse_modl(&ctx, base_ptr, curr_ptr, end_ptr, expected_next_chunk_offset);
   if (curr_ptr == nullptr) return false;
 
-  curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+  curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, base_ptr, curr_ptr, end_ptr);
   auto id_chunk_id = id(chunk_id);
   while (curr_ptr < end_ptr && id_chunk_id != id("END:")) {
     switch (id_chunk_id) {
@@ -515,7 +528,7 @@ bool parseRVM(class Store* store, Logger logger, const char* path, const void *
       return false;
     }
     if (curr_ptr < end_ptr) {
-      curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, curr_ptr, end_ptr);
+      curr_ptr = parse_chunk_header(chunk_id, expected_next_chunk_offset, dunno, base_ptr, curr_ptr, end_ptr);
       id_chunk_id = id(chunk_id);
     }
   }
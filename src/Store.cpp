@@ -1,8 +1,10 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <new>
 #include "Store.h"
 #include "StoreVisitor.h"
+#include "AddStats.h"
 
 
 
@@ -83,6 +85,16 @@ Connection* Store::newConnection()
   return connection;
 }
 
+void Store::setConnection(Geometry* geo, unsigned side, Connection* connection)
+{
+  assert(side < 6);
+  if (geo->connections == nullptr) {
+    geo->connections = (Connection**)arena.alloc(6 * sizeof(Connection*));
+    std::memset(geo->connections, 0, 6 * sizeof(Connection*));
+  }
+  geo->connections[side] = connection;
+}
+
 Geometry* Store::newGeometry(Node* parent)
 {
   assert(parent != nullptr);
@@ -146,7 +158,7 @@ Geometry* Store::cloneGeometry(Node* parent, const Geometry* src)
   dst->color = src->color;
 
   if (src->triangulation) {
-    dst->triangulation = arena.alloc<Triangulation>();
+    dst->triangulation = arenaTriangulation.alloc<Triangulation>();
 
     const auto * stri = src->triangulation;
     auto * dtri = dst->triangulation;
@@ -154,13 +166,15 @@ Geometry* Store::cloneGeometry(Node* parent, const Geometry* src)
     dtri->id = stri->id;
     if (stri->vertices_n) {
       dtri->vertices_n = stri->vertices_n;
-      dtri->vertices = (float*)arena.dup(stri->vertices, 3 * sizeof(float) * dtri->vertices_n);
-      dtri->normals = (float*)arena.dup(stri->normals, 3 * sizeof(float) * dtri->vertices_n);
-      dtri->texCoords = (float*)arena.dup(stri->texCoords, 2 * sizeof(float) * dtri->vertices_n);
+      dtri->vertices = (float*)arenaTriangulation.dup(stri->vertices, 3 * sizeof(float) * dtri->vertices_n);
+      dtri->normals = (float*)arenaTriangulation.dup(stri->normals, 3 * sizeof(float) * dtri->vertices_n);
+      if (stri->texCoords) {  // Not all shapes are tessellated with texture coordinates
+        dtri->texCoords = (float*)arenaTriangulation.dup(stri->texCoords, 2 * sizeof(float) * dtri->vertices_n);
+      }
     }
     if (stri->triangles_n) {
       dtri->triangles_n = stri->triangles_n;
-      dtri->indices = (uint32_t*)arena.dup(stri->indices, 3 * sizeof(uint32_t) * dtri->triangles_n);
+      dtri->indices = (uint32_t*)arenaTriangulation.dup(stri->indices, 3 * sizeof(uint32_t) * dtri->triangles_n);
     }
   }
 
@@ -185,6 +199,29 @@ Node* Store::newNode(Node* parent, Node::Kind kind)
   return grp;
 }
 
+void Store::adoptNodeRecurse(Node* node, unsigned firstGeometryId)
+{
+  numGroupsAllocated++;
+  if (node->kind == Node::Kind::Group) {
+    for (auto * geo = node->group.geometries.first; geo != nullptr; geo = geo->next) {
+      assert(firstGeometryId <= geo->id);
+      geo->id = numGeometriesAllocated + (geo->id - firstGeometryId);
+    }
+  }
+  for (auto * child = node->children.first; child != nullptr; child = child->next) {
+    adoptNodeRecurse(child, firstGeometryId);
+  }
+}
+
+void Store::adoptNode(Node* parent, Node* node, unsigned firstGeometryId, unsigned geometryCount)
+{
+  assert(parent != nullptr);
+  node->next = nullptr;
+  insert(parent->children, node);
+  adoptNodeRecurse(node, firstGeometryId);
+  numGeometriesAllocated += geometryCount;
+}
+
 Attribute* Store::getAttribute(Node* group, const char* key)
 {
   for (auto * attribute = group->attributes.first; attribute != nullptr; attribute = attribute->next) {
@@ -306,6 +343,7 @@ void Store::apply(StoreVisitor* visitor)
         visitor->beginModel(model);
 
         for (auto * group = model->children.first; group != nullptr; group = group->next) {
+          auto trace = traceGroup(group, visitor->traceGroups);
           apply(visitor, group);
         }
         visitor->endModel();
@@ -383,3 +421,203 @@ void Store::forwardGroupIdToGeometries()
   }
 }
 
+
+namespace {
+
+  // Compact moves an object by copying it and overwriting next of the original with the address
+  // of the copy. Moved geometries are also tagged with this kind, so references to geometries
+  // that are no longer in the hierarchy can be told apart.
+  const Geometry::Kind movedGeometryKind = Geometry::Kind(-1);
+
+  struct CompactCounts
+  {
+    size_t nodes = 0;
+    size_t geometries = 0;
+    size_t attributes = 0;
+    size_t colors = 0;
+  };
+
+  struct CompactContext
+  {
+    Arena* arena = nullptr;
+    Node* nodes = nullptr;
+    Geometry* geometries = nullptr;
+    Attribute* attributes = nullptr;
+    Color* colors = nullptr;
+    CompactCounts fill;
+  };
+
+  void countRecurse(CompactCounts& counts, const Node* node)
+  {
+    counts.nodes++;
+    for (auto * attribute = node->attributes.first; attribute != nullptr; attribute = attribute->next) {
+      counts.attributes++;
+    }
+    if (node->kind == Node::Kind::Model) {
+      for (auto * color = node->model.colors.first; color != nullptr; color = color->next) {
+        counts.colors++;
+      }
+    }
+    else if (node->kind == Node::Kind::Group) {
+      for (auto * geo = node->group.geometries.first; geo != nullptr; geo = geo->next) {
+        counts.geometries++;
+      }
+    }
+    for (auto * child = node->children.first; child != nullptr; child = child->next) {
+      countRecurse(counts, child);
+    }
+  }
+
+  void compactFacetGroup(Arena& arena, Geometry* geo)
+  {
+    const auto * src = geo->facetGroup.polygons;
+    auto * polygons = (Polygon*)arena.dup(src, sizeof(Polygon) * geo->facetGroup.polygons_n);
+    for (unsigned k = 0; k < geo->facetGroup.polygons_n; k++) {
+      auto & poly = polygons[k];
+      poly.contours = (Contour*)arena.dup(poly.contours, sizeof(Contour) * poly.contours_n);
+      for (unsigned i = 0; i < poly.contours_n; i++) {
+        auto & cont = poly.contours[i];
+        cont.vertices = (float*)arena.dup(cont.vertices, 3 * sizeof(float) * cont.vertices_n);
+        cont.normals = (float*)arena.dup(cont.normals, 3 * sizeof(float) * cont.vertices_n);
+      }
+    }
+    geo->facetGroup.polygons = polygons;
+  }
+
+  // Copies node and its subtree in depth-first order, the same order as apply visits them.
+  Node* compactRecurse(CompactContext& ctx, Node* src)
+  {
+    auto * dst = new(&ctx.nodes[ctx.fill.nodes++]) Node(*src);
+    dst->next = nullptr;
+    dst->children.clear();
+
+    dst->attributes.clear();
+    for (auto * attribute = src->attributes.first; attribute != nullptr; attribute = attribute->next) {
+      auto * copy = new(&ctx.attributes[ctx.fill.attributes++]) Attribute(*attribute);
+      copy->next = nullptr;
+      insert(dst->attributes, copy);
+    }
+
+    if (src->kind == Node::Kind::Model) {
+      dst->model.colors.clear();
+      for (auto * color = src->model.colors.first; color != nullptr; color = color->next) {
+        auto * copy = new(&ctx.colors[ctx.fill.colors++]) Color(*color);
+        copy->next = nullptr;
+        insert(dst->model.colors, copy);
+      }
+    }
+    else if (src->kind == Node::Kind::Group) {
+      dst->group.geometries.clear();
+      Geometry* next = nullptr;
+      for (auto * geo = src->group.geometries.first; geo != nullptr; geo = next) {
+        next = geo->next;
+        auto * copy = new(&ctx.geometries[ctx.fill.geometries++]) Geometry(*geo);
+        copy->next = nullptr;
+        if (copy->kind == Geometry::Kind::FacetGroup) {
+          compactFacetGroup(*ctx.arena, copy);
+        }
+        insert(dst->group.geometries, copy);
+
+        geo->next = copy;
+        geo->kind = movedGeometryKind;
+      }
+    }
+
+    for (auto * child = src->children.first; child != nullptr; child = child->next) {
+      insert(dst->children, compactRecurse(ctx, child));
+    }
+    return dst;
+  }
+
+  Geometry* movedGeometry(Geometry* geo)
+  {
+    return geo && geo->kind == movedGeometryKind ? geo->next : nullptr;
+  }
+
+}
+
+void Store::copyArenaSettings(const Store& src)
+{
+  arena.pageSize = src.arena.pageSize;
+  arena.hugePages = src.arena.hugePages;
+  arenaTriangulation.pageSize = src.arenaTriangulation.pageSize;
+  arenaTriangulation.hugePages = src.arenaTriangulation.hugePages;
+}
+
+void Store::compact()
+{
+  CompactCounts counts;
+  for (auto * root = roots.first; root != nullptr; root = root->next) {
+    countRecurse(counts, root);
+  }
+
+  Arena compacted;
+  compacted.pageSize = arena.pageSize;
+  compacted.hugePages = arena.hugePages;
+
+  CompactContext ctx;
+  ctx.arena = &compacted;
+  ctx.nodes = (Node*)compacted.alloc(sizeof(Node) * counts.nodes);
+  ctx.geometries = (Geometry*)compacted.alloc(sizeof(Geometry) * counts.geometries);
+  ctx.attributes = (Attribute*)compacted.alloc(sizeof(Attribute) * counts.attributes);
+  ctx.colors = (Color*)compacted.alloc(sizeof(Color) * counts.colors);
+
+  auto * first = roots.first;
+  roots.clear();
+  for (auto * src = first; src != nullptr; src = src->next) {
+    insert(roots, compactRecurse(ctx, src));
+  }
+  assert(ctx.fill.nodes == counts.nodes);
+  assert(ctx.fill.geometries == counts.geometries);
+  assert(ctx.fill.attributes == counts.attributes);
+  assert(ctx.fill.colors == counts.colors);
+
+  // Connections are kept if both geometries are still in the hierarchy. The moved connection, or
+  // null if it was dropped, is left in next of the original.
+  ListHeader<Connection> moved;
+  moved.clear();
+  Connection* next = nullptr;
+  for (auto * connection = connections.first; connection != nullptr; connection = next) {
+    next = connection->next;
+    connection->next = nullptr;
+
+    Geometry* geo[2] = { movedGeometry(connection->geo[0]), movedGeometry(connection->geo[1]) };
+    if (geo[0] == nullptr || (connection->geo[1] && geo[1] == nullptr)) continue;
+
+    auto * copy = new(compacted.alloc(sizeof(Connection))) Connection(*connection);
+    copy->next = nullptr;
+    copy->geo[0] = geo[0];
+    copy->geo[1] = geo[1];
+    insert(moved, copy);
+    connection->next = copy;
+  }
+  connections = moved;
+
+  for (size_t i = 0; i < counts.geometries; i++) {
+    auto & geo = ctx.geometries[i];
+    if (geo.connections == nullptr) continue;
+
+    auto * slots = (Connection**)compacted.alloc(6 * sizeof(Connection*));
+    for (unsigned k = 0; k < 6; k++) {
+      slots[k] = geo.connections[k] ? geo.connections[k]->next : nullptr;
+    }
+    geo.connections = slots;
+  }
+
+  ListHeader<DebugLine> lines;
+  lines.clear();
+  for (auto * line = debugLines.first; line != nullptr; line = line->next) {
+    auto * copy = new(compacted.alloc(sizeof(DebugLine))) DebugLine(*line);
+    copy->next = nullptr;
+    insert(lines, copy);
+  }
+  debugLines = lines;
+
+  if (stats) {
+    stats = (struct Stats*)compacted.dup(stats, sizeof(*stats));
+  }
+
+  arena.clear();
+  arena.adopt(compacted);
+}
+
@@ -1,7 +1,11 @@
 #pragma once
 #include <cstdint>
+#include <cassert>
+#include <type_traits>
 #include "Common.h"
 #include "LinAlg.h"
+#include "StoreVisitor.h"
+#include "Trace.h"
 
 struct Node;
 struct Geometry;
@@ -62,7 +66,7 @@ struct Connection
 
 struct Geometry
 {
-  enum struct Kind
+  enum struct Kind : uint8_t
   {
     Pyramid,
     Box,
@@ -76,7 +80,7 @@ struct Geometry
     Line,
     FacetGroup
   };
-  enum struct Type
+  enum struct Type : uint8_t
   {
     Primitive,
     Obstruction,
@@ -84,11 +88,12 @@ struct Geometry
   };
   Geometry* next = nullptr;                 // Next geometry in the list of geometries in group.
   Triangulation* triangulation = nullptr;
-  Geometry* next_comp = nullptr;            // Next geometry in list of geometries of this composite
 
-  Connection* connections[6] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+  // Connection per side, see connection(). Most geometries are never connected, so the six slots
+  // are kept in a side table allocated by Store::setConnection on the first connection.
+  Connection** connections = nullptr;
+
   const char* colorName = nullptr;
-  void * clientData = nullptr;
   uint32_t color = 0x202020u;
 
   Kind kind;
@@ -97,6 +102,12 @@ struct Geometry
 
   unsigned id;
 
+  Connection* connection(unsigned side) const { return connections ? connections[side] : nullptr; }
+
+  // Transform, bounds and parameters stay in the record instead of a cold side array: every pass
+  // that visits a geometry beyond following next reads the transform or bounds, and
+  // tessellation and export also read the parameters. An indirection would add a cache miss
+  // to each of them and save nothing on the passes that only walk the lists.
   Mat3x4f M_3x4;
   BBox3f bboxLocal;
   BBox3f bboxWorld;
@@ -263,8 +274,6 @@ struct DebugLine
 };
 
 
-class StoreVisitor;
-
 class Store
 {
 public:
@@ -282,6 +291,13 @@ public:
 
   Node* cloneNode(Node* parent, const Node* src);
 
+  // Moves a node built in another store to be the last child of parent, without copying. The
+  // memory of the node must be handed over as well, e.g. with arena.adopt, and its strings must
+  // have been interned into this store. The geometry ids [firstGeometryId, firstGeometryId +
+  // geometryCount) of the other store are renumbered to follow on from the geometries allocated
+  // in this store.
+  void adoptNode(Node* parent, Node* node, unsigned firstGeometryId, unsigned geometryCount);
+
   Node* findRootGroup(const char* name);
 
   Attribute* getAttribute(Node* group, const char* key);
@@ -292,8 +308,17 @@ public:
 
   Connection* newConnection();
 
+  // Sets the connection of one of the six sides of geo, allocating its connection slots if needed.
+  void setConnection(Geometry* geo, unsigned side, Connection* connection);
+
   void apply(StoreVisitor* visitor);
 
+  // Same traversal as apply, but with the hooks bound at compile time to the overrides in Visitor
+  // or the empty defaults of StoreVisitor, so unused hooks compile away and the used ones can be
+  // inlined. Visitor must derive from StoreVisitor. Instantiate it explicitly in the translation
+  // unit that defines the hooks of Visitor for them to be inlined.
+  template<typename Visitor> void traverse(Visitor& visitor);
+
   unsigned groupCount_() const { return numGroups; }
   unsigned groupCountAllocated() const { return numGroupsAllocated; }
   unsigned leafCount() const { return numLeaves; }
@@ -309,7 +334,7 @@ public:
   Connection* getFirstConnection() { return connections.first; }
   DebugLine* getFirstDebugLine() { return debugLines.first; }
 
-  Arena arena;
+  Arena arena;                // Hierarchy, geometries and everything else but triangulations
   Arena arenaTriangulation;
   struct Stats* stats = nullptr;
   struct Connectivity* conn = nullptr;
@@ -320,6 +345,18 @@ public:
 
   void forwardGroupIdToGeometries();
 
+  // Moves nodes, geometries, attributes, colors, connections, debug lines and facet group data
+  // into a fresh arena and releases the old one. Nodes, geometries and attributes are laid out in
+  // arrays in the order apply visits them, so later traversals walk memory sequentially, and the
+  // memory of nodes unlinked from the hierarchy is reclaimed. Connections to geometries no longer
+  // in the hierarchy are dropped. Invalidates all pointers into the hierarchy, triangulations
+  // live in arenaTriangulation and are left in place.
+  void compact();
+
+  // Gives the arenas the page size and huge page setting of the arenas of src, for stores that
+  // replace src or whose pages src adopts.
+  void copyArenaSettings(const Store& src);
+
 private:
   unsigned numGroups = 0;
   unsigned numGroupsAllocated = 0;
@@ -333,10 +370,77 @@ private:
 
   void updateCountsRecurse(Node* group);
 
+  void adoptNodeRecurse(Node* node, unsigned firstGeometryId);
+
   void apply(StoreVisitor* visitor, Node* group);
 
+  template<typename Visitor> void traverse(Visitor& visitor, Node* group);
+
   ListHeader<Node> roots;
   ListHeader<DebugLine> debugLines;
   ListHeader<Connection> connections;
   
-};
\ No newline at end of file
+};
+
+
+// Hooks are called qualified with Visitor:: to bypass virtual dispatch.
+template<typename Visitor>
+void Store::traverse(Visitor& visitor, Node* group)
+{
+  assert(group->kind == Node::Kind::Group);
+  visitor.Visitor::beginGroup(group);
+
+  if (group->attributes.first) {
+    visitor.Visitor::beginAttributes(group);
+    for (auto * a = group->attributes.first; a != nullptr; a = a->next) {
+      visitor.Visitor::attribute(a->key, a->val);
+    }
+    visitor.Visitor::endAttributes(group);
+  }
+
+  if (group->group.geometries.first != nullptr) {
+    visitor.Visitor::beginGeometries(group);
+    for (auto * geo = group->group.geometries.first; geo != nullptr; geo = geo->next) {
+      visitor.Visitor::geometry(geo);
+    }
+    visitor.Visitor::endGeometries();
+  }
+
+  visitor.Visitor::doneGroupContents(group);
+
+  if (group->children.first != nullptr) {
+    visitor.Visitor::beginChildren(group);
+    for (auto * g = group->children.first; g != nullptr; g = g->next) {
+      traverse(visitor, g);
+    }
+    visitor.Visitor::endChildren();
+  }
+
+  visitor.Visitor::EndGroup();
+}
+
+template<typename Visitor>
+void Store::traverse(Visitor& visitor)
+{
+  static_assert(std::is_base_of_v<StoreVisitor, Visitor>, "Visitor must derive from StoreVisitor");
+  visitor.Visitor::init(*this);
+  do {
+    for (auto * file = roots.first; file != nullptr; file = file->next) {
+      assert(file->kind == Node::Kind::File);
+      visitor.Visitor::beginFile(file);
+
+      for (auto * model = file->children.first; model != nullptr; model = model->next) {
+        assert(model->kind == Node::Kind::Model);
+        visitor.Visitor::beginModel(model);
+
+        for (auto * group = model->children.first; group != nullptr; group = group->next) {
+          auto trace = traceGroup(group, visitor.traceGroups);
+          traverse(visitor, group);
+        }
+        visitor.Visitor::endModel();
+      }
+
+      visitor.Visitor::endFile();
+    }
+  } while (visitor.Visitor::done() == false);
+}
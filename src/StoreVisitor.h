@@ -38,4 +38,7 @@ public:
 
   virtual void endGeometries() {}
 
+  // Record a trace span for each top-level group visited, set by the tessellation and export
+  // visitors, see Trace.h.
+  bool traceGroups = false;
 };
@@ -10,13 +10,6 @@
 #include "Tessellator.h"
 #include "LinAlgOps.h"
 
-namespace {
-
-  const float pi = float(M_PI);
-  const float half_pi = float(0.5*M_PI);
-
-}
-
 Tessellator::Tessellator(Logger logger, float tolerance, float cullLeafThreshold, float cullGeometryThreshold, unsigned maxSamples) :
   logger(logger),
   tolerance(tolerance),
@@ -24,6 +17,7 @@ Tessellator::Tessellator(Logger logger, float tolerance, float cullLeafThreshold
   cullLeafThresholdScaled(tolerance * cullLeafThreshold),
   cullGeometryThresholdScaled(tolerance * cullGeometryThreshold)
 {
+  traceGroups = true;
 }
 
 Tessellator::~Tessellator()
@@ -123,59 +117,8 @@ void Tessellator::geometry(Geometry* geo)
   }
 
 
-  Triangulation* tri = nullptr;
-  switch (geo->kind) {
-  case Geometry::Kind::Pyramid:
-    tri = factory->pyramid(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::Box:
-    tri = factory->box(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::RectangularTorus:
-    tri = factory->rectangularTorus(&store->arenaTriangulation, geo, scale);
-    break;
-    
-  case Geometry::Kind::CircularTorus:
-    tri = factory->circularTorus(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::EllipticalDish:
-    tri = factory->sphereBasedShape(&store->arenaTriangulation, geo, geo->ellipticalDish.baseRadius, half_pi, 0.f, geo->ellipticalDish.height / geo->ellipticalDish.baseRadius, scale);
-    break;
-
-  case Geometry::Kind::SphericalDish: {
-    float r_circ = geo->sphericalDish.baseRadius;
-    auto h = geo->sphericalDish.height;
-    float r_sphere = (r_circ*r_circ + h * h) / (2.f*h);
-    float sinval = std::min(1.f, std::max(-1.f, r_circ / r_sphere));
-    float arc = asin(sinval);
-    if (r_circ < h) { arc = pi - arc; }
-    tri = factory->sphereBasedShape(&store->arenaTriangulation, geo, r_sphere, arc, h - r_sphere, 1.f, scale);
-    break;
-  }
-  case Geometry::Kind::Snout:
-    tri = factory->snout(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::Cylinder:
-    tri = factory->cylinder(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::Sphere:
-    tri = factory->sphereBasedShape(&store->arenaTriangulation, geo, 0.5f*geo->sphere.diameter, pi, 0.f, 1.f, scale);
-    break;
-
-  case Geometry::Kind::FacetGroup:
-    tri = factory->facetGroup(&store->arenaTriangulation, geo, scale);
-    break;
-
-  case Geometry::Kind::Line:  // Handled at start of function.
-  default:
-    assert(false && "Unhandled primitive type");
-    break;
-  }
+  Triangulation* tri = factory->geometry(&store->arenaTriangulation, geo, scale);
+  assert(tri && "Unhandled primitive type");
 
   geo->triangulation = tri;
   vertices += uint64_t(tri->vertices_n);
@@ -198,3 +141,5 @@ void Tessellator::geometry(Geometry* geo)
 
   tessellated++;
 }
+
+template void Store::traverse<Tessellator>(Tessellator& visitor);
@@ -2,6 +2,7 @@
 
 #include "Common.h"
 #include "StoreVisitor.h"
+#include "Store.h"
 #include "LinAlg.h"
 
 class TriangulationFactory
@@ -29,6 +30,9 @@ public:
 
   Triangulation* sphereBasedShape(Arena* arena, const  Geometry* geo, float radius, float arc, float shift_z, float scale_z, float scale);
 
+  // Triangulates geo with the function for its kind, returns null for lines.
+  Triangulation* geometry(Arena* arena, const Geometry* geo, float scale);
+
   unsigned discardedCaps = 0;
 
 private:
@@ -117,4 +121,7 @@ protected:
   Triangulation* getTriangulation(Geometry* geo);
 
   virtual void process(Geometry* /*geometry*/) {}
-};
\ No newline at end of file
+};
+
+// Instantiated in Tessellator.cpp where the hooks can be inlined.
+extern template void Store::traverse<Tessellator>(Tessellator& visitor);
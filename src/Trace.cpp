@@ -0,0 +1,163 @@
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+#include "Trace.h"
+#include "Store.h"
+
+namespace {
+
+  struct TraceEvent
+  {
+    const char* name;
+    const char* detail;
+    double begin;     // Microseconds since traceStart
+    double duration;
+  };
+
+  struct TraceThread
+  {
+    unsigned tid = 0;
+    const char* name = nullptr;
+    std::vector<TraceEvent> events;
+    Arena strings;
+  };
+
+  std::chrono::high_resolution_clock::time_point traceTime0;
+  std::mutex traceMutex;
+  std::vector<std::unique_ptr<TraceThread>> traceThreads;
+  thread_local TraceThread* traceThread = nullptr;
+
+  // Buffer of the calling thread, created on the first span it records. Threads are joined
+  // before the trace is written, so buffers are only read once nobody appends to them.
+  TraceThread* getTraceThread()
+  {
+    if (traceThread == nullptr) {
+      std::lock_guard<std::mutex> lock(traceMutex);
+      traceThreads.emplace_back(std::make_unique<TraceThread>());
+      traceThread = traceThreads.back().get();
+      traceThread->tid = static_cast<unsigned>(traceThreads.size());
+    }
+    return traceThread;
+  }
+
+  const char* traceDup(TraceThread* thread, const char* str)
+  {
+    return str ? (const char*)thread->strings.dup(str, strlen(str) + 1) : nullptr;
+  }
+
+  double traceMicroseconds(std::chrono::high_resolution_clock::time_point t)
+  {
+    return std::chrono::duration<double, std::micro>(t - traceTime0).count();
+  }
+
+  // Unlike stage names, group names and paths come from the input and need escaping.
+  void writeJsonString(FILE* out, const char* str)
+  {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+      switch (*p) {
+      case '"': fputs("\\\"", out); break;
+      case '\\': fputs("\\\\", out); break;
+      case '\n': fputs("\\n", out); break;
+      case '\r': fputs("\\r", out); break;
+      case '\t': fputs("\\t", out); break;
+      default:
+        if (*p < 0x20) fprintf(out, "\\u%04x", *p);
+        else fputc(*p, out);
+        break;
+      }
+    }
+    fputc('"', out);
+  }
+
+}
+
+bool traceActive = false;
+
+void traceStart()
+{
+  traceTime0 = std::chrono::high_resolution_clock::now();
+  traceActive = true;
+  traceThreadName("main");
+}
+
+void traceThreadName(const char* name)
+{
+  if (!traceActive) return;
+  TraceThread* thread = getTraceThread();
+  thread->name = traceDup(thread, name);
+}
+
+void traceSpan(const char* name, const char* detail, std::chrono::high_resolution_clock::time_point begin)
+{
+  auto end = std::chrono::high_resolution_clock::now();
+  TraceThread* thread = getTraceThread();
+  double t0 = traceMicroseconds(begin);
+  thread->events.push_back(TraceEvent{ traceDup(thread, name), traceDup(thread, detail), t0, traceMicroseconds(end) - t0 });
+}
+
+bool traceWrite(Logger logger, const char* path)
+{
+#ifdef _WIN32
+  FILE* out = nullptr;
+  auto err = fopen_s(&out, path, "w");
+  if (err != 0) {
+    char buf[256];
+    if (strerror_s(buf, sizeof(buf), err) != 0) {
+      buf[0] = '\0';
+    }
+    logger(2, "Failed to open %s for writing: %s", path, buf);
+    return false;
+  }
+  assert(out);
+#else
+  FILE* out = fopen(path, "w");
+  if (out == nullptr) {
+    logger(2, "Failed to open %s for writing.", path);
+    return false;
+  }
+#endif
+  setvbuf(out, nullptr, _IOFBF, 1024 * 1024);
+
+  // Complete events (ph X) with times in microseconds, and a metadata event naming each track.
+  std::lock_guard<std::mutex> lock(traceMutex);
+  const char* separator = "\n";
+  fprintf(out, "{\"traceEvents\":[");
+  for (const auto& thread : traceThreads) {
+    if (thread->name) {
+      fprintf(out, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", separator, thread->tid);
+      writeJsonString(out, thread->name);
+      fprintf(out, "}}");
+      separator = ",\n";
+    }
+    for (const TraceEvent& event : thread->events) {
+      fprintf(out, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+              separator, thread->tid, event.begin, event.duration);
+      writeJsonString(out, event.name);
+      if (event.detail) {
+        fprintf(out, ",\"args\":{\"detail\":");
+        writeJsonString(out, event.detail);
+        fprintf(out, "}");
+      }
+      fprintf(out, "}");
+      separator = ",\n";
+    }
+  }
+  fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+  bool rv = ferror(out) == 0;
+  if (fclose(out) != 0) rv = false;
+  if (!rv) {
+    logger(2, "Failed to write %s", path);
+  }
+  return rv;
+}
+
+const char* traceGroupName(const Node* group)
+{
+  return group->group.name ? group->group.name : "group";
+}
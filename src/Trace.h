@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include "Common.h"
+
+// Chrome trace event output, enabled by traceStart and written by traceWrite. Each thread
+// records spans into its own buffer, so the trace shows one track per thread. When tracing is
+// not started, recording a span is a single test of traceActive.
+extern bool traceActive;
+
+void traceStart();
+
+// Names the track of the calling thread.
+void traceThreadName(const char* name);
+
+// Records a span from begin until now on the track of the calling thread. Name and detail are
+// copied, detail may be null.
+void traceSpan(const char* name, const char* detail, std::chrono::high_resolution_clock::time_point begin);
+
+bool traceWrite(Logger logger, const char* path);
+
+// Name of a group for its span, which is "group" for groups without a name.
+const char* traceGroupName(const struct Node* group);
+
+// Records a span from construction to destruction if tracing is active and name is not null.
+class TraceScope
+{
+public:
+  TraceScope(const char* name, const char* detail = nullptr)
+  {
+    if (traceActive) {
+      this->name = name;
+      this->detail = detail;
+      begin = std::chrono::high_resolution_clock::now();
+    }
+  }
+  ~TraceScope() { if (name) traceSpan(name, detail, begin); }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name = nullptr;
+  const char* detail = nullptr;
+  std::chrono::high_resolution_clock::time_point begin;
+};
+
+// Span over a top-level group if enabled, for passes that go over the store group by group.
+inline TraceScope traceGroup(const struct Node* group, bool enabled = true)
+{
+  return TraceScope(traceActive && enabled ? traceGroupName(group) : nullptr);
+}
@@ -40,7 +40,7 @@ namespace {
   Interface getInterface(const Geometry* geo, unsigned o)
   {
     Interface interface;
-    auto * connection = geo->connections[o];
+    auto * connection = geo->connection(o);
     auto ix = connection->geo[0] == geo ? 1 : 0;
     auto scale = getScale(geo->M_3x4);
     switch (geo->kind) {
@@ -349,7 +349,7 @@ Triangulation* TriangulationFactory::pyramid(Arena* arena, const Geometry* geo,
   };
 
   for (unsigned i = 0; i < 6; i++) {
-    auto * con = geo->connections[i];
+    auto * con = geo->connection(i);
     if (cap[i] == false || con == nullptr || con->flags != Connection::Flags::HasRectangularSide) continue;
 
     if (doInterfacesMatch(geo, con)) {
@@ -450,7 +450,7 @@ Triangulation* TriangulationFactory::box(Arena* arena, const Geometry* geo, floa
     1e-5 <= box.lengths[2],
   };
   for (unsigned i = 0; i < 6; i++) {
-    auto * con = geo->connections[i];
+    auto * con = geo->connection(i);
     if (faces[i] == false || con == nullptr || con->flags != Connection::Flags::HasRectangularSide) continue;
 
     if (doInterfacesMatch(geo, con)) {
@@ -520,7 +520,7 @@ Triangulation* TriangulationFactory::rectangularTorus(Arena* arena, const Geomet
   };
 
   for (unsigned i = 0; i < 2; i++) {
-    auto * con = geo->connections[i];
+    auto * con = geo->connection(i);
     if (con && con->flags == Connection::Flags::HasRectangularSide) {
       if (doInterfacesMatch(geo, con)) {
         cap[i] = false;
@@ -655,7 +655,7 @@ Triangulation* TriangulationFactory::circularTorus(Arena* arena, const Geometry*
   bool shell = true;
   bool cap[2] = { true, true };
   for (unsigned i = 0; i < 2; i++) {
-    auto * con = geo->connections[i];
+    auto * con = geo->connection(i);
     if (con && con->flags == Connection::Flags::HasCircularSide) {
       if (doInterfacesMatch(geo, con)) {
         cap[i] = false;
@@ -788,7 +788,7 @@ Triangulation* TriangulationFactory::snout(Arena* arena, const Geometry* geo, fl
   bool cap[2] = { true, true };
   float radii[2] = { geo->snout.radius_b, geo->snout.radius_t };
   for (unsigned i = 0; i < 2; i++) {
-    auto * con = geo->connections[i];
+    auto * con = geo->connection(i);
     if (con && con->flags == Connection::Flags::HasCircularSide) {
       if (doInterfacesMatch(geo, con)) {
         cap[i] = false;
@@ -920,7 +920,7 @@ Triangulation* TriangulationFactory::cylinder(Arena* arena, const Geometry* geo,
   bool shell = true;
   bool cap[2] = { true, true };
   for (unsigned i = 0; i < 2; i++) {
-    auto * con = geo->connections[i];
+    auto * con = geo->connection(i);
     if (con && con->flags == Connection::Flags::HasCircularSide) {
       if (doInterfacesMatch(geo, con)) {
         cap[i] = false;
@@ -1308,3 +1308,47 @@ Triangulation* TriangulationFactory::facetGroup(Arena* arena, const Geometry* ge
   return tri;
 }
 
+Triangulation* TriangulationFactory::geometry(Arena* arena, const Geometry* geo, float scale)
+{
+  switch (geo->kind) {
+  case Geometry::Kind::Pyramid:
+    return pyramid(arena, geo, scale);
+
+  case Geometry::Kind::Box:
+    return box(arena, geo, scale);
+
+  case Geometry::Kind::RectangularTorus:
+    return rectangularTorus(arena, geo, scale);
+
+  case Geometry::Kind::CircularTorus:
+    return circularTorus(arena, geo, scale);
+
+  case Geometry::Kind::EllipticalDish:
+    return sphereBasedShape(arena, geo, geo->ellipticalDish.baseRadius, half_pi, 0.f, geo->ellipticalDish.height / geo->ellipticalDish.baseRadius, scale);
+
+  case Geometry::Kind::SphericalDish: {
+    float r_circ = geo->sphericalDish.baseRadius;
+    auto h = geo->sphericalDish.height;
+    float r_sphere = (r_circ*r_circ + h * h) / (2.f*h);
+    float sinval = std::min(1.f, std::max(-1.f, r_circ / r_sphere));
+    float arc = asin(sinval);
+    if (r_circ < h) { arc = pi - arc; }
+    return sphereBasedShape(arena, geo, r_sphere, arc, h - r_sphere, 1.f, scale);
+  }
+  case Geometry::Kind::Snout:
+    return snout(arena, geo, scale);
+
+  case Geometry::Kind::Cylinder:
+    return cylinder(arena, geo, scale);
+
+  case Geometry::Kind::Sphere:
+    return sphereBasedShape(arena, geo, 0.5f*geo->sphere.diameter, pi, 0.f, 1.f, scale);
+
+  case Geometry::Kind::FacetGroup:
+    return facetGroup(arena, geo, scale);
+
+  case Geometry::Kind::Line:
+  default:
+    return nullptr;
+  }
+}
@@ -3,6 +3,7 @@
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <Windows.h>
+#include <Psapi.h>
 
 #else
 
@@ -11,6 +12,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 
 #endif
 
@@ -22,6 +24,11 @@
 #include <cctype>
 #include <chrono>
 #include <algorithm>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <optional>
 
 #include "Parser.h"
 #include "Tessellator.h"
@@ -33,6 +40,9 @@
 #include "ChunkTiny.h"
 #include "AddGroupBBox.h"
 #include "Colorizer.h"
+#include "Instrumentation.h"
+#include "Trace.h"
+#include "MultiVisitor.h"
 
 #include "parserREV.h"
 
@@ -43,23 +53,31 @@
 
 void logger(unsigned level, const char* msg, ...)
 {
+  const char* prefix = "";
   switch (level) {
-  case 0: fprintf(stderr, "[I] "); break;
-  case 1: fprintf(stderr, "[W] "); break;
-  case 2: fprintf(stderr, "[E] "); break;
+  case 0: prefix = "[I] "; break;
+  case 1: prefix = "[W] "; break;
+  case 2: prefix = "[E] "; break;
   }
 
+  // Format into a single write so lines from concurrent exporters don't interleave
+  char buf[2048];
   va_list argptr;
   va_start(argptr, msg);
-  vfprintf(stderr, msg, argptr);
+  vsnprintf(buf, sizeof(buf), msg, argptr);
   va_end(argptr);
-  fprintf(stderr, "\n");
+  fprintf(stderr, "%s%s\n", prefix, buf);
 }
 
+// Files up to this size are read in full when mapped. Larger ones, which may not fit in memory
+// next to the store, are paged in on demand with sequential read-ahead.
+constexpr size_t populateLimit = size_t(1) << 30;
+
 template<typename F>
 bool
 processFile(const std::string& path, F f)
 {
+  TraceScope trace("processFile", path.c_str());
   bool rv = false;
 #ifdef _WIN32
   char buf[MAX_PATH];
@@ -76,14 +94,14 @@ processFile(const std::string& path, F f)
     size_t fileSize = (size_t(hiSize) << 32u) + loSize;
 
     HANDLE m = CreateFileMappingA(h, 0, PAGE_READONLY, 0, 0, NULL);
-    if (m == INVALID_HANDLE_VALUE) {
-      logger(2, "CreateFileMappingA returned INVALID_HANDLE_VALUE");
+    if (m == NULL) {
+      logger(2, "CreateFileMappingA returned NULL");
       rv = false;
     }
     else {
       const void * ptr = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
       if (ptr == nullptr) {
-        logger(2, "MapViewOfFile returned INVALID_HANDLE_VALUE");
+        logger(2, "MapViewOfFile returned NULL");
         rv = false;
       }
       else {
@@ -107,26 +125,28 @@ processFile(const std::string& path, F f)
       logger(2, "%s: fstat failed: %s", path.c_str(), strerror(errno));
     }
     else {
+      size_t size = static_cast<size_t>(stat.st_size);
 
 #ifdef __linux__
-      void * ptr = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0);
+      void * ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | (size <= populateLimit ? MAP_POPULATE : 0), fd, 0);
 #else
-      void * ptr = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      void * ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
 #endif
       if(ptr == MAP_FAILED) {
         logger(2, "%s: mmap failed: %s", path.c_str(), strerror(errno));
       }
       else {
-        if(madvise(ptr, stat.st_size, MADV_SEQUENTIAL) != 0) {
+        if(madvise(ptr, size, MADV_SEQUENTIAL) != 0) {
           logger(1, "%s: madvise(MADV_SEQUENTIAL) failed: %s", path.c_str(), strerror(errno));
         }
-        rv = f(ptr, stat.st_size);
-        if(munmap(ptr, stat.st_size) != 0) {
+        rv = f(ptr, size);
+        if(munmap(ptr, size) != 0) {
           logger(2, "%s: munmap failed: %s", path.c_str(), strerror(errno));
           rv = false;
         }
       }
     }
+    close(fd);
   }
 
 #endif
@@ -157,6 +177,7 @@ Options:
   --output-json=<filename.json>       Write hierarchy with attributes to a json file.
   --output-txt=<filename.txt>         Dump all group names to a text file.
   --output-rev=filename.rev           Write database as a text review file.
+  --output-rvm=filename.rvm           Write database as a binary rvm file.
   --output-obj=<filenamestem>         Write geometry to an obj file. The suffices .obj and .mtl are
                                       added to the filenamestem.
   --output-gltf=<filename.gltf>       Write geometry into a GLTF file (pure JSON with buffers base64
@@ -180,7 +201,26 @@ Options:
                                       multiple files, where 0 implies no split. Geometries and
                                       attributes below the split point are included in the first
                                       file, while subsequent files while have empty nodes just to
-                                      represent the hierarchy. Default value is 0.
+                                      represent the hierarchy. An index file with the suffix
+                                      .index.json lists the files and their bounding boxes.
+                                      Default value is 0.
+  --output-gltf-threads=<uint>        Number of threads used to write split files concurrently,
+                                      where 0 implies one per hardware thread. Default value is 0.
+  --output-gltf-quantize=<bool>       Store positions as 16-bit integers and normals as 8-bit
+                                      integers using the KHR_mesh_quantization extension, with
+                                      positions relative to the local origin of each mesh. Default
+                                      value is false.
+  --output-gltf-meshopt=<bool>        Compress vertex and index data of GLB files using the
+                                      EXT_meshopt_compression extension. Combined with quantization,
+                                      normals are octahedral-encoded. Default value is false.
+  --output-threads=<uint>             Number of outputs that are written concurrently. Default value
+                                      0 writes all requested outputs at the same time, 1 writes them
+                                      one after the other.
+  --output-tiles=<filename>.json      Partition tessellated geometry spatially into an octree of GLB
+                                      files and write a 3D Tiles 1.1 tileset.json that refers to them.
+                                      Quantization, meshopt and thread options of glTF output apply.
+  --output-tiles-max-triangles=<uint> Subdivide tiles until they contain at most this number of
+                                      triangles. Default value is 100000.
   --group-bounding-boxes              Include wireframe of boundingboxes of groups in output.
   --color-attribute=key               Specify which attributes that contain color, empty key
                                       implies that material id of group is used.
@@ -188,6 +228,26 @@ Options:
                                       is 0.1.
   --cull-scale=value                  Cull objects smaller than cull-scale times tolerance. Set to
                                       a negative value to disable culling. Disabled by default.
+  --huge-pages=<bool>                 Back the memory arenas of the store with huge pages where the
+                                      platform supports it. Must precede the input files. Default
+                                      value is false.
+  --compact=<bool>                    Rewrite the store into contiguous arrays in traversal order
+                                      after discarding and flattening, which speeds up later passes
+                                      and releases the memory of discarded groups. Needs twice the
+                                      memory of the hierarchy while copying. Default value is false.
+  --print-stats=<bool>                Count groups and geometries by kind and log the result at the
+                                      end. Default value is true.
+  --stats-json=<filename>.json        Write the time spent in each stage of the pipeline and counters
+                                      reported by the stages as JSON.
+  --trace=<filename>.json             Write a Chrome trace event file with a span for each stage,
+                                      each input file, each export task, and each top-level group
+                                      visited by tessellation and export (including passes fused
+                                      with tessellation), on one track per thread. Open it in
+                                      Perfetto or chrome://tracing. Must precede the input files.
+  --report-memory[=<filename>.json]   Record arena sizes, pages mapped for huge pages and peak
+                                      resident memory after each stage of the pipeline, and after
+                                      each exporter when they run one at a time. Logged as a table,
+                                      or written as JSON if a filename is given.
   --output-hsf=filename.hsf		      Write geometry into a hsf file. The suffix .hsf is added to the filename.
 
 Post bug reports or questions at https://github.com/cdyk/rvmparser
@@ -213,14 +273,249 @@ Post bug reports or questions at https://github.com/cdyk/rvmparser
     }
   }
 
+  // Largest resident set size of the process so far, zero if unavailable.
+  size_t peakResidentBytes()
+  {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+      return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return size_t(usage.ru_maxrss);         // bytes
+#else
+    return size_t(usage.ru_maxrss) * 1024;  // kilobytes
+#endif
+#endif
+  }
+
+  // Stages that run between parsing and output, in the order they are executed.
+  enum struct Stage : uint32_t
+  {
+    Colorize,
+    Discard,
+    FlattenRegex,
+    Compact,
+    Connect,
+    Align,
+    BBox,
+    Tessellate,
+    Flatten,
+    Stats,
+    Count
+  };
+
+  const char* stageName(Stage stage)
+  {
+    switch (stage) {
+    case Stage::Colorize: return "colorize";
+    case Stage::Discard: return "discard";
+    case Stage::FlattenRegex: return "flatten-regex";
+    case Stage::Compact: return "compact";
+    case Stage::Connect: return "connect";
+    case Stage::Align: return "align";
+    case Stage::BBox: return "bbox";
+    case Stage::Tessellate: return "tessellate";
+    case Stage::Flatten: return "flatten";
+    case Stage::Stats: return "stats";
+    default:
+      assert(false && "Illegal stage");
+      return "";
+    }
+  }
+
+  // Set of stages to run. Requiring a stage also requires the stages whose results it uses.
+  struct Plan
+  {
+    uint32_t stages = 0;
+
+    bool has(Stage stage) const { return (stages >> uint32_t(stage)) & 1; }
+
+    void require(Stage stage)
+    {
+      if (has(stage)) return;
+      stages |= 1u << uint32_t(stage);
+      switch (stage) {
+      case Stage::Align:
+        require(Stage::Connect);    // Aligns the connections that connect finds
+        break;
+      case Stage::Tessellate:
+        require(Stage::Align);      // Caps between connected geometries are discarded
+        require(Stage::BBox);       // Culling uses the world bounding boxes
+        break;
+      default:
+        break;
+      }
+    }
+  };
+
+  // Visitors that share a single traversal of the store, named after the stages they implement.
+  struct Pass
+  {
+    MultiVisitor visitors;
+    std::string name;
+    unsigned count = 0;
+
+    // A pass with a single visitor uses the statically dispatched traversal of its type.
+    StoreVisitor* single = nullptr;
+    void(*traverseSingle)(Store* store, StoreVisitor* visitor) = nullptr;
+
+    template<typename Visitor>
+    void add(Visitor* visitor, const char* stage)
+    {
+      visitors.add(visitor);
+      if (count++ == 0) {
+        single = visitor;
+        traverseSingle = [](Store* store, StoreVisitor* visitor) { store->traverse(*static_cast<Visitor*>(visitor)); };
+      }
+      if (!name.empty()) name += "+";
+      name += stage;
+    }
+
+    void run(Store* store)
+    {
+      if (count == 1) {
+        traverseSingle(store, single);
+      }
+      else {
+        store->apply(&visitors);
+      }
+    }
+
+    bool empty() const { return count == 0; }
+  };
+
+  struct ExportTask
+  {
+    const char* name;
+    std::function<bool()> run;
+    double milliseconds = 0.0;
+    bool ok = false;
+  };
+
+  // Runs the tasks on up to maxThreads threads (zero means one per task), returns false if any
+  // of them failed. The tasks only read shared state and write their own output. When they run
+  // one after another on the calling thread, finished is called after each of them, so the
+  // state left by a single task can be inspected.
+  bool runExportTasks(std::vector<ExportTask>& tasks, size_t maxThreads, const std::function<void(const ExportTask&)>& finished)
+  {
+    size_t threadCount = maxThreads == 0 ? tasks.size() : std::min(maxThreads, tasks.size());
+    std::atomic<size_t> next = 0;
+    const std::thread::id caller = std::this_thread::get_id();
+    auto worker = [&]()
+    {
+      if (std::this_thread::get_id() != caller) {
+        traceThreadName("export task");
+      }
+      for (size_t i = next++; i < tasks.size(); i = next++) {
+        TraceScope trace(tasks[i].name);
+        auto time0 = std::chrono::high_resolution_clock::now();
+        tasks[i].ok = tasks[i].run();
+        tasks[i].milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - time0).count();
+        if (threadCount == 1 && finished) {
+          finished(tasks[i]);
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    bool rv = true;
+    for (const auto& task : tasks) {
+      rv = rv && task.ok;
+    }
+    return rv;
+  }
+
+  struct MemorySample
+  {
+    std::string stage;
+    ArenaStats arena;
+    ArenaStats arenaTriangulation;
+    ArenaStats strings;
+    size_t peakResident;
+  };
+
+  void logMemoryReport(Logger logger, const std::vector<MemorySample>& samples)
+  {
+    // Huge pages counts the store and triangulation pages mapped for huge pages, which shows
+    // whether --huge-pages carried over to stores made by parsing, flattening and compacting.
+    logger(0, "Memory (KB):            store  triangulation      strings     peak rss   huge pages");
+    for (const auto& sample : samples) {
+      logger(0, "    %-14s %12zu   %12zu %12zu %12zu %12zu", sample.stage.c_str(),
+             sample.arena.bytesReserved / 1024,
+             sample.arenaTriangulation.bytesReserved / 1024,
+             sample.strings.bytesReserved / 1024,
+             sample.peakResident / 1024,
+             sample.arena.hugePages + sample.arenaTriangulation.hugePages);
+    }
+  }
+
+  bool writeMemoryReport(Logger logger, const std::vector<MemorySample>& samples, const char* path)
+  {
+#ifdef _WIN32
+    FILE* out = nullptr;
+    auto err = fopen_s(&out, path, "w");
+    if (err != 0) {
+      char buf[256];
+      if (strerror_s(buf, sizeof(buf), err) != 0) {
+        buf[0] = '\0';
+      }
+      logger(2, "Failed to open %s for writing: %s", path, buf);
+      return false;
+    }
+    assert(out);
+#else
+    FILE* out = fopen(path, "w");
+    if (out == nullptr) {
+      logger(2, "Failed to open %s for writing.", path);
+      return false;
+    }
+#endif
+
+    auto writeArena = [out](const char* name, const ArenaStats& stats, const char* separator) {
+      fprintf(out, "      \"%s\": { \"requested\": %zu, \"reserved\": %zu, \"pages\": %zu, \"hugePages\": %zu, \"wasted\": %zu }%s\n",
+              name, stats.bytesRequested, stats.bytesReserved, stats.pages, stats.hugePages, stats.bytesWasted, separator);
+    };
+
+    fprintf(out, "{\n  \"stages\": [\n");
+    for (size_t i = 0; i < samples.size(); i++) {
+      const auto& sample = samples[i];
+      fprintf(out, "    {\n      \"stage\": \"%s\",\n", sample.stage.c_str());
+      writeArena("arena", sample.arena, ",");
+      writeArena("arenaTriangulation", sample.arenaTriangulation, ",");
+      writeArena("strings", sample.strings, ",");
+      fprintf(out, "      \"peakResident\": %zu\n    }%s\n", sample.peakResident, i + 1 < samples.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    bool rv = ferror(out) == 0;
+    if (fclose(out) != 0) rv = false;
+    if (!rv) {
+      logger(2, "Failed to write %s", path);
+    }
+    return rv;
+  }
+
 }
 
 
 int main(int argc, char** argv)
 {
   int rv = 0;
-  bool should_tessellate = false;
-  bool should_colorize = false;
+  bool print_stats = true;
+  bool compact = false;
 
   float tolerance = 0.1f;
   float cullScale = -10000.1f;
@@ -239,13 +534,45 @@ int main(int argc, char** argv)
   bool output_gltf_attributes = true;
   bool output_gltf_merge_geos = true;
   size_t output_gltf_split_level = 0;
+  bool output_gltf_quantize = false;
+  bool output_gltf_meshopt = false;
+  size_t output_gltf_threads = 0;
+  size_t output_threads = 0;
+  std::string output_tiles;
+  size_t output_tiles_max_triangles = 100000;
 
   std::string output_rev;
+  std::string output_rvm;
   std::string output_hsf;
   std::string output_obj_stem;
   std::string color_attribute;
+  bool report_memory = false;
+  std::string report_memory_json;
+  std::string stats_json;
+  std::string trace_json;
   
   Store* store = new Store();
+  Instrumentation instrumentation;
+
+  std::vector<MemorySample> memorySamples;
+  auto sampleMemory = [&](const std::string& stage)
+  {
+    if (report_memory) {
+      memorySamples.push_back(MemorySample{ stage,
+                                            store->arena.stats,
+                                            store->arenaTriangulation.stats,
+                                            store->strings.stats(),
+                                            peakResidentBytes() });
+    }
+  };
+
+  auto runPass = [&](Pass& pass)
+  {
+    ScopedTimer timer(&instrumentation, pass.name.c_str());
+    pass.run(store);
+    logger(0, "Pass %s in %lldms", pass.name.c_str(), timer.stop());
+    sampleMemory(pass.name);
+  };
 
   for (int i = 1; i < argc; i++) {
     auto arg = std::string(argv[i]);
@@ -260,6 +587,10 @@ int main(int argc, char** argv)
         groupBoundingBoxes = true;
         continue;
       }
+      else if (arg == "--report-memory") {
+        report_memory = true;
+        continue;
+      }
 
       auto e = arg.find('=');
       if (e != std::string::npos) {
@@ -289,16 +620,24 @@ int main(int argc, char** argv)
           output_rev = val;
           continue;
         }
+        else if (key == "--output-rvm") {
+          output_rvm = val;
+          continue;
+        }
         else if (key == "--output-obj") {
           output_obj_stem = val;
-          should_tessellate = true;
-          should_colorize = true;
+          continue;
+        }
+        else if (key == "--output-tiles") {
+          output_tiles = val;
+          continue;
+        }
+        else if (key == "--output-tiles-max-triangles") {
+          output_tiles_max_triangles = std::stoul(val);
           continue;
         }
         else if (key == "--output-gltf") {
           output_gltf = val;
-          should_tessellate = true;
-          should_colorize = true;
           continue;
         }
         else if (key == "--output-gltf-rotate-z-to-y") {
@@ -321,6 +660,22 @@ int main(int argc, char** argv)
           output_gltf_split_level = std::stoul(val);
           continue;
         }
+        else if (key == "--output-threads") {
+          output_threads = std::stoul(val);
+          continue;
+        }
+        else if (key == "--output-gltf-threads") {
+          output_gltf_threads = std::stoul(val);
+          continue;
+        }
+        else if (key == "--output-gltf-quantize") {
+          output_gltf_quantize = parseBool(logger, arg, val);
+          continue;
+        }
+        else if (key == "--output-gltf-meshopt") {
+          output_gltf_meshopt = parseBool(logger, arg, val);
+          continue;
+        }
         else if (key == "--color-attribute") {
           color_attribute = val;
           continue;
@@ -329,19 +684,43 @@ int main(int argc, char** argv)
           tolerance = std::max(1e-6f, std::stof(val));
           continue;
         }
+        else if (key == "--compact") {
+          compact = parseBool(logger, arg, val);
+          continue;
+        }
+        else if (key == "--print-stats") {
+          print_stats = parseBool(logger, arg, val);
+          continue;
+        }
+        else if (key == "--stats-json") {
+          stats_json = val;
+          continue;
+        }
+        else if (key == "--trace") {
+          trace_json = val;
+          traceStart();
+          continue;
+        }
+        else if (key == "--report-memory") {
+          report_memory = true;
+          report_memory_json = val;
+          continue;
+        }
+        else if (key == "--huge-pages") {
+          store->arena.hugePages = parseBool(logger, arg, val);
+          store->arenaTriangulation.hugePages = store->arena.hugePages;
+          continue;
+        }
         else if (key == "--cull-scale") {
           cullScale = std::stof(val); // set to negative to disable culling.
           continue;
         }
         else if (key == "--chunk-tiny") {
           chunkTinyVertexThreshold = std::stoul(val);
-          should_tessellate = true;
           continue;
         }
         else if (key == "--output-hsf") {
           output_hsf = val;
-          should_tessellate = true;
-          should_colorize = true;
           continue;
         }
       }
@@ -366,6 +745,7 @@ int main(int argc, char** argv)
 
     // parse rvm file
     if (extension == ".rvm") {
+      ScopedTimer timer(&instrumentation, "parse-rvm");
       if (processFile(arg, [store, arg](const void * ptr, size_t size) { return parseRVM(store, logger, arg.c_str(), ptr, size); }))
       {
         fprintf(stderr, "Successfully parsed %s\n", arg.c_str());
@@ -380,6 +760,7 @@ int main(int argc, char** argv)
 
     // parse attributes file
     if (extension == ".txt" || extension == ".att") {
+      ScopedTimer timer(&instrumentation, "parse-att");
       if (processFile(arg, [store](const void* ptr, size_t size) { return parseAtt(store, logger, ptr, size); })) {
         fprintf(stderr, "Successfully parsed %s\n", arg.c_str());
       }
@@ -393,6 +774,7 @@ int main(int argc, char** argv)
 
     // parse rev file
     if (extension == ".rev") {
+        ScopedTimer timer(&instrumentation, "parse-rev");
         if (processFile(arg, [store, arg](const void* ptr, size_t size) { return parseREV(store, logger, arg.c_str(), ptr, size); }))
         {
             fprintf(stderr, "Successfully parsed %s\n", arg.c_str());
@@ -405,15 +787,50 @@ int main(int argc, char** argv)
         continue;
     }
   }
+  sampleMemory("parse");
+
+  // Each requested output declares the stages it needs, everything else is skipped.
+  Plan plan;
+  if (!discard_groups.empty()) plan.require(Stage::Discard);
+  if (!keep_regex.empty()) plan.require(Stage::FlattenRegex);
+  if (!keep_groups.empty()) plan.require(Stage::Flatten);
+  if (compact) plan.require(Stage::Compact);
+  if (chunkTinyVertexThreshold) {
+    plan.require(Stage::Tessellate);
+    plan.require(Stage::Flatten);
+  }
+  if (!output_json.empty()) plan.require(Stage::BBox);
+  if (!output_obj_stem.empty() || !output_gltf.empty() || !output_tiles.empty() || !output_hsf.empty()) {
+    plan.require(Stage::Colorize);
+    plan.require(Stage::Tessellate);
+  }
+  if (print_stats) plan.require(Stage::Stats);
+  if (rv == 0) {
+    std::string planned = "parse";
+    for (uint32_t i = 0; i < uint32_t(Stage::Count); i++) {
+      if (plan.has(Stage(i))) {
+        planned += ", ";
+        planned += stageName(Stage(i));
+      }
+    }
+    logger(0, "Plan: %s", planned.c_str());
+  }
 
-  if ((rv == 0) && should_colorize) {
-    Colorizer colorizer(logger, color_attribute.empty() ? nullptr : color_attribute.c_str());
-    store->apply(&colorizer);
+  // Colors are derived from the hierarchy, so they must be assigned before flatten-regex changes
+  // it. Otherwise colorize joins the bbox pass below.
+  Colorizer colorizer(logger, color_attribute.empty() ? nullptr : color_attribute.c_str());
+  const bool colorizeFirst = plan.has(Stage::Colorize) && plan.has(Stage::FlattenRegex);
+  if (rv == 0 && colorizeFirst) {
+    Pass pass;
+    pass.add(&colorizer, stageName(Stage::Colorize));
+    runPass(pass);
   }
 
-  if (rv == 0 && !discard_groups.empty()) {
+  if (rv == 0 && plan.has(Stage::Discard)) {
+    ScopedTimer timer(&instrumentation, "discard");
     if (processFile(discard_groups, [store](const void * ptr, size_t size) { return discardGroups(store, logger, ptr, size); })) {
-      logger(0, "Processed %s", discard_groups.c_str());
+      logger(0, "Processed %s (%lldms)", discard_groups.c_str(), timer.stop());
+      sampleMemory("discard");
     }
     else {
       logger(2, "Failed to parse %s", discard_groups.c_str());
@@ -421,17 +838,22 @@ int main(int argc, char** argv)
     }
   } 
 
-  if (rv == 0 && !keep_regex.empty()) {
+  if (rv == 0 && plan.has(Stage::FlattenRegex)) {
     unsigned prevGroups = store->groupCount_();
     unsigned prevGeos = store->geometryCount_();
-    auto time0 = std::chrono::high_resolution_clock::now();
+    ScopedTimer timer(&instrumentation, "flatten-regex");
     if (flattenRegex(store, logger, keep_regex.c_str())) {
-      long long ms = std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::high_resolution_clock::now() - time0)).count();
+      long long ms = timer.stop();
       store->updateCounts();
+      instrumentation.addCounter("flatten-regex", "groupsBefore", prevGroups);
+      instrumentation.addCounter("flatten-regex", "groupsAfter", store->groupCount_());
+      instrumentation.addCounter("flatten-regex", "geometriesBefore", prevGeos);
+      instrumentation.addCounter("flatten-regex", "geometriesAfter", store->geometryCount_());
       logger(0, "Flatten hierarchy using regex '%s' in %lldms, %u -> %u nodes, %u -> %u geometries",
              keep_regex.c_str(), ms,
              prevGroups, store->groupCount_(),
              prevGeos, store->geometryCount_());
+      sampleMemory("flatten-regex");
     }
     else {
       logger(2, "Failed to flatten hierarchy using regex '%s'", keep_regex.c_str());
@@ -439,155 +861,274 @@ int main(int argc, char** argv)
     }
   }
 
-  if (rv == 0) {
-    connect(store, logger);
-    align(store, logger);
+  if (rv == 0 && plan.has(Stage::Compact)) {
+    size_t prevReserved = store->arena.stats.bytesReserved;
+    ScopedTimer timer(&instrumentation, "compact");
+    store->compact();
+    long long ms = timer.stop();
+    instrumentation.addCounter("compact", "bytesBefore", prevReserved);
+    instrumentation.addCounter("compact", "bytesAfter", store->arena.stats.bytesReserved);
+    logger(0, "Compacted store in %lldms, %zukb -> %zukb", ms,
+           prevReserved / 1024, store->arena.stats.bytesReserved / 1024);
+    sampleMemory("compact");
+  }
+
+  if (rv == 0 && plan.has(Stage::Connect)) {
+    ScopedTimer timer(&instrumentation, "connect");
+    connect(store, logger, &instrumentation);
+    timer.stop();
+    sampleMemory("connect");
   }
 
-  if (rv == 0 && (should_tessellate || !output_json.empty())) {
-    AddGroupBBox addGroupBBox;
-    store->apply(&addGroupBBox);
+  if (rv == 0 && plan.has(Stage::Align)) {
+    ScopedTimer timer(&instrumentation, "align");
+    align(store, logger, &instrumentation);
+    timer.stop();
+    sampleMemory("align");
   }
 
-  if (rv == 0 && should_tessellate ) {
+  // Flatten collects the tags of the store up front, so chunk-tiny can select tags in the
+  // tessellation pass.
+  std::optional<Flatten> flatten;
+  if (rv == 0 && plan.has(Stage::Flatten)) {
+    flatten.emplace(store);
+    if (!keep_groups.empty()) {
+      if (processFile(keep_groups, [f = &*flatten](const void * ptr, size_t size) {f->setKeep(ptr, size); return true; })) {
+        fprintf(stderr, "Processed %s\n", keep_groups.c_str());
+      }
+      else {
+        fprintf(stderr, "Failed to parse %s\n", keep_groups.c_str());
+        rv = ERROR_GENERIC;
+      }
+    }
+  }
+
+  // Without flatten the store does not change after the last pass, so the statistics can be
+  // gathered in that pass.
+  AddStats addStats;
+  bool statsPending = plan.has(Stage::Stats);
+
+  AddGroupBBox addGroupBBox;
+  Pass bboxPass;
+  if (plan.has(Stage::Colorize) && !colorizeFirst) bboxPass.add(&colorizer, stageName(Stage::Colorize));
+  if (plan.has(Stage::BBox)) bboxPass.add(&addGroupBBox, stageName(Stage::BBox));
+  if (statsPending && !plan.has(Stage::Tessellate) && !plan.has(Stage::Flatten)) {
+    bboxPass.add(&addStats, stageName(Stage::Stats));
+    statsPending = false;
+  }
+  if (rv == 0 && !bboxPass.empty()) {
+    runPass(bboxPass);
+  }
+
+  // The tessellator reads group bounding boxes on entering a group, so it cannot share the pass
+  // that computes them on leaving it.
+  if (rv == 0 && plan.has(Stage::Tessellate)) {
     float cullLeafThreshold = -1.f;
     float cullGeometryThreshold = -1.f;
     unsigned maxSamples = 100;
 
-    auto time0 = std::chrono::high_resolution_clock::now();
     Tessellator tessellator(logger, tolerance, cullLeafThreshold, cullGeometryThreshold, maxSamples);
-    store->apply(&tessellator);
-    auto time1 = std::chrono::high_resolution_clock::now();
-    auto e0 = std::chrono::duration_cast<std::chrono::milliseconds>((time1 - time0)).count();
-    logger(0, "Tessellated %u items of %u into %llu vertices and %llu triangles (tol=%f, %lluk, %lldms)",
+    std::optional<ChunkTiny> chunkTiny;
+
+    Pass pass;
+    pass.add(&tessellator, stageName(Stage::Tessellate));
+    if (chunkTinyVertexThreshold) {
+      chunkTiny.emplace(*flatten, chunkTinyVertexThreshold);
+      pass.add(&*chunkTiny, "chunk-tiny");
+    }
+    if (statsPending && !plan.has(Stage::Flatten)) {
+      pass.add(&addStats, stageName(Stage::Stats));
+      statsPending = false;
+    }
+    runPass(pass);
+
+    logger(0, "Tessellated %u items of %u into %llu vertices and %llu triangles (tol=%f, %lluk)",
            tessellator.tessellated,
            tessellator.processed,
            tessellator.vertices,
            tessellator.triangles,
            tolerance,
-           (4*3*tessellator.vertices + 4*3*tessellator.triangles)/1024,
-           e0);
+           (4*3*tessellator.vertices + 4*3*tessellator.triangles)/1024);
+    instrumentation.addCounter("tessellate", "processed", tessellator.processed);
+    instrumentation.addCounter("tessellate", "tessellated", tessellator.tessellated);
+    instrumentation.addCounter("tessellate", "leafCulled", tessellator.leafCulled);
+    instrumentation.addCounter("tessellate", "geometryCulled", tessellator.geometryCulled);
+    instrumentation.addCounter("tessellate", "vertices", tessellator.vertices);
+    instrumentation.addCounter("tessellate", "triangles", tessellator.triangles);
   }
 
-  bool do_flatten = false;
-  Flatten flatten(store);
-  if (rv == 0 && !keep_groups.empty()) {
-    if (processFile(keep_groups, [f = &flatten](const void * ptr, size_t size) {f->setKeep(ptr, size); return true; })) {
-      fprintf(stderr, "Processed %s\n", keep_groups.c_str());
-      do_flatten = true;
-
-    }
-    else {
-      fprintf(stderr, "Failed to parse %s\n", keep_groups.c_str());
-      rv = ERROR_GENERIC;
-    }
+  if (rv == 0 && flatten) {
+    ScopedTimer timer(&instrumentation, "flatten");
+    store->updateCounts();
+    unsigned prevGroups = store->groupCount_();
+    unsigned prevGeos = store->geometryCount_();
+    auto * storeNew = flatten->run();
+    delete store;
+    store = storeNew;
+    store->updateCounts();
+    logger(0, "Flattened hierarchy in %lldms, %u -> %u nodes, %u -> %u geometries",
+           timer.stop(),
+           prevGroups, store->groupCount_(),
+           prevGeos, store->geometryCount_());
+    instrumentation.addCounter("flatten", "selectedTags", flatten->selectedTagsCount());
+    instrumentation.addCounter("flatten", "activeTags", flatten->activeTagsCount());
+    instrumentation.addCounter("flatten", "groupsBefore", prevGroups);
+    instrumentation.addCounter("flatten", "groupsAfter", store->groupCount_());
+    instrumentation.addCounter("flatten", "geometriesBefore", prevGeos);
+    instrumentation.addCounter("flatten", "geometriesAfter", store->geometryCount_());
+    sampleMemory("flatten");
   }
+  flatten.reset();
 
-  if (rv == 0 && chunkTinyVertexThreshold) {
-    ChunkTiny chunkTiny(flatten, chunkTinyVertexThreshold);
-    store->apply(&chunkTiny);
-    do_flatten = true;
+  if (rv == 0 && statsPending) {
+    Pass pass;
+    pass.add(&addStats, stageName(Stage::Stats));
+    runPass(pass);
   }
 
-  if (do_flatten) {
-    auto * storeNew = flatten.run();
-    delete store;
-    store = storeNew;
-  }
 
+  // The exporters below only read the store, run them as concurrent tasks. Each has its own
+  // scratch state and output file, and string interning (used by glTF) is thread-safe.
+  std::vector<ExportTask> exportTasks;
 
   if (rv == 0 && !output_json.empty()) {
-    auto time0 = std::chrono::high_resolution_clock::now();
-    if (exportJson(store, logger, output_json.c_str())) {
-      auto time1 = std::chrono::high_resolution_clock::now();
-      auto e = std::chrono::duration_cast<std::chrono::milliseconds>((time1 - time0)).count();
-      logger(0, "Exported json into %s (%lldms)", output_json.c_str(), e);
-    }
-    else {
-      logger(2, "Failed to export obj file.\n");
-      rv = ERROR_GENERIC;
-    }
+    exportTasks.push_back(ExportTask{ "export-json", [&]()
+    {
+      if (!exportJson(store, logger, output_json.c_str())) {
+        logger(2, "Failed to export json into %s", output_json.c_str());
+        return false;
+      }
+      return true;
+    } });
   }
 
   if (rv == 0 && !output_txt.empty()) {
-
+    exportTasks.push_back(ExportTask{ "export-txt", [&]()
+    {
 #ifdef _WIN32
-    FILE* out = nullptr;
-    if (fopen_s(&out, output_txt.c_str(), "w") == 0) {
+      FILE* out = nullptr;
+      if (fopen_s(&out, output_txt.c_str(), "w") != 0) {
 #else
-    FILE* out = fopen(output_txt.c_str(), "w");
-    if(out != nullptr) {
+      FILE* out = fopen(output_txt.c_str(), "w");
+      if (out == nullptr) {
 #endif
-
+        logger(2, "Failed to open %s for writing", output_txt.c_str());
+        return false;
+      }
       DumpNames dumpNames;
       dumpNames.setOutput(out);
       store->apply(&dumpNames);
       fclose(out);
-    }
-    else {
-      logger(2, "Failed to open %s for writing", output_txt.c_str());
-      rv = ERROR_GENERIC;
-    }
+      return true;
+    } });
   }
 
   if (rv == 0 && !output_rev.empty()) {
-    auto time0 = std::chrono::high_resolution_clock::now();
-    if (exportRev(store, logger, output_rev.c_str())) {
-      long long e = std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::high_resolution_clock::now() - time0)).count();
-      logger(0, "Exported rev file %s (%lldms)", output_rev.c_str(), e);
-    }
-    else {
-      logger(2, "Failed to export rev file %s", output_rev.c_str());
-      rv = ERROR_GENERIC;
-    }
+    exportTasks.push_back(ExportTask{ "export-rev", [&]()
+    {
+      if (!exportRev(store, logger, output_rev.c_str())) {
+        logger(2, "Failed to export rev file %s", output_rev.c_str());
+        return false;
+      }
+      return true;
+    } });
+  }
+
+  if (rv == 0 && !output_rvm.empty()) {
+    exportTasks.push_back(ExportTask{ "export-rvm", [&]()
+    {
+      if (!exportRvm(store, logger, output_rvm.c_str())) {
+        logger(2, "Failed to export rvm file %s", output_rvm.c_str());
+        return false;
+      }
+      return true;
+    } });
   }
 
   if (rv == 0 && !output_obj_stem.empty()) {
-    assert(should_tessellate);
- 
-    auto time0 = std::chrono::high_resolution_clock::now();
-    ExportObj exportObj;
-    exportObj.groupBoundingBoxes = groupBoundingBoxes;
-    if (exportObj.open((output_obj_stem + ".obj").c_str(), (output_obj_stem + ".mtl").c_str())) {
+    assert(plan.has(Stage::Tessellate));
+    exportTasks.push_back(ExportTask{ "export-obj", [&]()
+    {
+      ExportObj exportObj;
+      exportObj.groupBoundingBoxes = groupBoundingBoxes;
+      if (!exportObj.open((output_obj_stem + ".obj").c_str(), (output_obj_stem + ".mtl").c_str())) {
+        logger(2, "Failed to export obj file.\n");
+        return false;
+      }
       store->apply(&exportObj);
-
-      auto time1 = std::chrono::high_resolution_clock::now();
-      auto e = std::chrono::duration_cast<std::chrono::milliseconds>((time1 - time0)).count();
-      logger(0, "Exported obj into %s(.obj|.mtl) (%lldms)", output_obj_stem.c_str(), e);
-    }
-    else {
-      logger(2, "Failed to export obj file.\n");
-      rv = ERROR_GENERIC;
-    }
+      return true;
+    } });
   }
 
   if (rv == 0 && !output_gltf.empty()) {
-    assert(should_tessellate);
-    auto time0 = std::chrono::high_resolution_clock::now();
-    if (exportGLTF(store, logger,
-                   output_gltf.c_str(),
-                   output_gltf_split_level,
-                   output_gltf_rotate_z_to_y,
-                   output_gltf_center,
-                   output_gltf_attributes,
-                   output_gltf_merge_geos))
+    assert(plan.has(Stage::Tessellate));
+    exportTasks.push_back(ExportTask{ "export-gltf", [&]()
     {
-      long long e = std::chrono::duration_cast<std::chrono::milliseconds>((std::chrono::high_resolution_clock::now() - time0)).count();
-      logger(0, "Exported gltf in %lldms", e);
-    }
-    else {
-      logger(2, "Failed to export gltf into %s", output_gltf.c_str());
+      if (!exportGLTF(store, logger,
+                      output_gltf.c_str(),
+                      output_gltf_split_level,
+                      output_gltf_rotate_z_to_y,
+                      output_gltf_center,
+                      output_gltf_attributes,
+                      output_gltf_merge_geos,
+                      output_gltf_quantize,
+                      output_gltf_meshopt,
+                      output_gltf_threads))
+      {
+        logger(2, "Failed to export gltf into %s", output_gltf.c_str());
+        return false;
+      }
+      return true;
+    } });
+  }
+
+  if (rv == 0 && !output_tiles.empty()) {
+    assert(plan.has(Stage::Tessellate));
+    exportTasks.push_back(ExportTask{ "export-tiles", [&]()
+    {
+      if (!exportTiles(store, logger,
+                       output_tiles.c_str(),
+                       output_tiles_max_triangles,
+                       output_gltf_quantize,
+                       output_gltf_meshopt,
+                       output_gltf_threads))
+      {
+        logger(2, "Failed to export tiles into %s", output_tiles.c_str());
+        return false;
+      }
+      return true;
+    } });
+  }
+
+  if (!exportTasks.empty()) {
+    ScopedTimer timer(&instrumentation, "export");
+    // Sequential exporters are sampled one by one, concurrent ones only as a whole.
+    size_t samples = memorySamples.size();
+    if (!runExportTasks(exportTasks, output_threads, [&](const ExportTask& task) { sampleMemory(task.name); })) {
       rv = ERROR_GENERIC;
     }
+    for (const auto& task : exportTasks) {
+      instrumentation.addStage(task.name, task.milliseconds);
+      if (task.ok) {
+        logger(0, "Finished %s in %.0fms", task.name, task.milliseconds);
+      }
+    }
+    logger(0, "Exported %zu outputs in %lldms", exportTasks.size(), timer.stop());
+    if (memorySamples.size() == samples) {
+      sampleMemory("export");
+    }
   }
 
+  // The HOOPS stream toolkit keeps a global segment stack, so hsf is written on its own.
   if (rv == 0 && !output_hsf.empty()) {
-      assert(should_tessellate);
+      assert(plan.has(Stage::Tessellate));
 
-      auto time0 = std::chrono::high_resolution_clock::now();
+      ScopedTimer timer(&instrumentation, "export-hsf");
 	   ExportHsf exportHsf(output_hsf.c_str());
 	   exportHsf.groupBoundingBoxes = groupBoundingBoxes;
        store->apply(&exportHsf);
+       logger(0, "Exported hsf into %s (%lldms)", output_hsf.c_str(), timer.stop());
+       sampleMemory("export-hsf");
 
 	   /*if (exportHsf.open((output_obj_stem + ".obj").c_str(), (output_obj_stem + ".mtl").c_str())) {
 		   store->apply(&exportHsf);
@@ -602,8 +1143,6 @@ int main(int argc, char** argv)
 	   }*/
   }
 
-  AddStats addStats;
-  store->apply(&addStats);
   auto * stats = store->stats;
   if (stats) {
     logger(0, "Stats:");
@@ -627,6 +1166,39 @@ int main(int argc, char** argv)
     logger(0, "        Lines              %d", stats->line_n);
   }
 
+  logger(0, "Executed stages:");
+  for (const auto& stage : instrumentation.stages) {
+    logger(0, "    %-20s %10.1fms", stage.name, stage.milliseconds);
+  }
+
+  const struct { const char* name; ArenaStats stats; } arenas[] = {
+    { "Store", store->arena.stats },
+    { "Triangulation", store->arenaTriangulation.stats },
+    { "Strings", store->strings.stats() }
+  };
+  logger(0, "Arenas:                    requested     reserved  pages       wasted");
+  for (const auto & arena : arenas) {
+    logger(0, "    %-20s %12zu %12zu %6zu %12zu", arena.name,
+           arena.stats.bytesRequested, arena.stats.bytesReserved, arena.stats.pages, arena.stats.bytesWasted);
+  }
+
+  if (!stats_json.empty() && !instrumentation.writeJson(logger, stats_json.c_str())) {
+    rv = ERROR_GENERIC;
+  }
+
+  if (!trace_json.empty() && !traceWrite(logger, trace_json.c_str())) {
+    rv = ERROR_GENERIC;
+  }
+
+  if (report_memory) {
+    if (report_memory_json.empty()) {
+      logMemoryReport(logger, memorySamples);
+    }
+    else if (!writeMemoryReport(logger, memorySamples, report_memory_json.c_str())) {
+      rv = ERROR_GENERIC;
+    }
+  }
+
   delete store;
  
   return rv;
@@ -2,12 +2,15 @@
 #include "Store.h"
 #include "LinAlgOps.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <string>
+#include <charconv>
+#include <chrono>
+#include <thread>
 #include <vector>
 #include <cstdarg>
 
@@ -17,6 +20,7 @@ struct Context {
   Store* store = nullptr;
   Logger logger = nullptr;
   const char* path = nullptr;
+  StringInterning* strings = nullptr;  // Where names are interned, may be shared between threads
 
   char* errbuf = nullptr;
   size_t errbuf_size = 0;
@@ -51,20 +55,64 @@ inline void skip_ws(const char*& p, const char* end)
 inline bool read_u32(uint32_t& out, const char*& p, const char* end)
 {
   skip_ws(p, end);
-  if (p >= end) return false;
-  char* ep = nullptr;
-  unsigned long v = std::strtoul(p, &ep, 10);
-  if (ep == p) return false;
-  if (v > 0xFFFFFFFFul) return false;
-  out = static_cast<uint32_t>(v);
+  // from_chars takes no sign, but strtoul, which this replaced, accepted a leading '+'
+  const char* q = p < end && *p == '+' ? p + 1 : p;
+  if (q >= end) return false;
+  auto [ep, ec] = std::from_chars(q, end, out);
+  if (ec != std::errc()) return false;
   p = ep;
   return true;
 }
 
+// Powers of ten that are exactly representable as doubles
+const double exactPow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Scanner for plain decimals like the %14.5f output of ExportRev. The digits are
+// accumulated into an integer which is exact in a double, and a single division by an
+// exact power of ten then gives the correctly rounded double. Rounding that to float is
+// only off when the double lies exactly halfway between two floats, and those cases, as
+// well as exponents, inf/nan and too many digits, fall back to strtof.
 inline bool read_f32(float& out, const char*& p, const char* end)
 {
   skip_ws(p, end);
   if (p >= end) return false;
+
+  const char* q = p;
+  bool negative = false;
+  if (*q == '-' || *q == '+') {
+    negative = *q == '-';
+    q++;
+  }
+
+  uint64_t mantissa = 0;
+  unsigned digits = 0;
+  unsigned fractionDigits = 0;
+  for (; q < end && '0' <= *q && *q <= '9'; q++, digits++) {
+    mantissa = 10 * mantissa + static_cast<uint64_t>(*q - '0');
+  }
+  if (q < end && *q == '.') {
+    for (q++; q < end && '0' <= *q && *q <= '9'; q++, digits++, fractionDigits++) {
+      mantissa = 10 * mantissa + static_cast<uint64_t>(*q - '0');
+    }
+  }
+
+  if (0 < digits && digits <= 15 && fractionDigits < sizeof(exactPow10) / sizeof(exactPow10[0]) &&
+      (q == end || std::isspace(static_cast<unsigned char>(*q))))
+  {
+    double d = static_cast<double>(mantissa) / exactPow10[fractionDigits];
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    if ((bits & 0x1FFFFFFF) != 0x10000000) {  // Not halfway between two floats
+      float v = static_cast<float>(d);
+      out = negative ? -v : v;
+      p = q;
+      return true;
+    }
+  }
+
   char* ep = nullptr;
   float v = std::strtof(p, &ep);
   if (ep == p) return false;
@@ -87,27 +135,37 @@ inline bool read_line(const char*& line_s, const char*& line_e, const char*& p,
   return true;
 }
 
-inline std::string to_string_trim(const char* s, const char* e)
+constexpr uint32_t id(const char* str)
 {
-  // trim leading/trailing spaces for ID line; for content strings we keep spaces.
-  while (s < e && (*s == ' ' || *s == '\t')) ++s;
-  while (e > s && (*(e - 1) == ' ' || *(e - 1) == '\t')) --e;
-  return std::string(s, e);
+  return str[3] << 24 | str[2] << 16 | str[1] << 8 | str[0];
 }
 
-inline const char* intern_line_as_string(Store* store, const char* s, const char* e)
+struct ChunkId
+{
+  uint32_t id = 0;            // Four-character id packed as in parseRVM, 0 if not four characters
+  const char* str = nullptr;  // Trimmed id line, for diagnostics
+  int len = 0;
+};
+
+inline const char* intern_line_as_string(Context* ctx, const char* s, const char* e)
 {
-  return store->strings.intern(s, e);
+  return ctx->strings->intern(s, e);
 }
 
 // Reads a chunk header:
 // - First line: chunk id (e.g., "HEAD", "MODL", "CNTB", "CNTE", "PRIM", "OBST", "INSU", "END:").
 // - Next: two uints on one line (as ExportRev prints "%6u%6u\n"), but we accept any whitespace between.
-inline bool read_chunk_header_txt(std::string& id, const char*& p, const char* end)
+inline bool read_chunk_header_txt(ChunkId& chunk, const char*& p, const char* end)
 {
   const char *ls = nullptr, *le = nullptr;
   if (!read_line(ls, le, p, end)) return false;
-  id = to_string_trim(ls, le);
+  // trim leading/trailing spaces for ID line
+  while (ls < le && (*ls == ' ' || *ls == '\t')) ++ls;
+  while (le > ls && (*(le - 1) == ' ' || *(le - 1) == '\t')) --le;
+  chunk.str = ls;
+  chunk.len = static_cast<int>(le - ls);
+  chunk.id = chunk.len == 4 ? id(ls) : 0;
+
   // After the id line, there should be two uints
   uint32_t u0 = 0, u1 = 0;
   if (!read_u32(u0, p, end)) return false;
@@ -129,7 +187,7 @@ inline bool read_chunk_header_txt(std::string& id, const char*& p, const char* e
   return true;
 }
 
-bool parse_prim_txt(Context* ctx, const std::string& id, const char*& p, const char* end)
+bool parse_prim_txt(Context* ctx, const ChunkId& chunk, const char*& p, const char* end)
 {
   // Parent must be a Group
   if (ctx->stack.empty() || ctx->stack.back()->kind != Node::Kind::Group) {
@@ -143,10 +201,12 @@ bool parse_prim_txt(Context* ctx, const std::string& id, const char*& p, const c
   auto* g = ctx->store->newGeometry(ctx->stack.back());
 
   // type from chunk id
-  if (id == "PRIM") g->type = Geometry::Type::Primitive;
-  else if (id == "OBST") g->type = Geometry::Type::Obstruction;
-  else if (id == "INSU") g->type = Geometry::Type::Insulation;
-  else { set_error(ctx, "Unknown geometry chunk id '%s'", id.c_str()); return false; }
+  switch (chunk.id) {
+  case id("PRIM"): g->type = Geometry::Type::Primitive; break;
+  case id("OBST"): g->type = Geometry::Type::Obstruction; break;
+  case id("INSU"): g->type = Geometry::Type::Insulation; break;
+  default: set_error(ctx, "Unknown geometry chunk id '%.*s'", chunk.len, chunk.str); return false;
+  }
 
   // Transparency is not present in text; inherit from parent group
   g->transparency = ctx->stack.back()->group.transparency;
@@ -335,7 +395,7 @@ bool parse_cntb_txt(Context* ctx, const char*& p, const char* end)
   // name (full line)
   const char *ls = nullptr, *le = nullptr;
   if (!read_line(ls, le, p, end)) { set_error(ctx, "CNTB: missing name"); return false; }
-  g->group.name = intern_line_as_string(ctx->store, ls, le);
+  g->group.name = intern_line_as_string(ctx, ls, le);
 
   // translation vec3 in mm -> convert to meters
   if (!read_f32(g->group.translation[0], p, end) ||
@@ -354,17 +414,17 @@ bool parse_cntb_txt(Context* ctx, const char*& p, const char* end)
 
   // Children: loop until CNTE
   while (p < end) {
-    std::string cid;
-    if (!read_chunk_header_txt(cid, p, end)) { set_error(ctx, "CNTB: unexpected EOF while reading children"); return false; }
-    if (cid == "CNTE") {
+    ChunkId chunk;
+    if (!read_chunk_header_txt(chunk, p, end)) { set_error(ctx, "CNTB: unexpected EOF while reading children"); return false; }
+    if (chunk.id == id("CNTE")) {
       // No extra payload in text; balanced end of group
       break;
-    } else if (cid == "CNTB") {
+    } else if (chunk.id == id("CNTB")) {
       if (!parse_cntb_txt(ctx, p, end)) return false;
-    } else if (cid == "PRIM" || cid == "OBST" || cid == "INSU") {
-      if (!parse_prim_txt(ctx, cid, p, end)) return false;
+    } else if (chunk.id == id("PRIM") || chunk.id == id("OBST") || chunk.id == id("INSU")) {
+      if (!parse_prim_txt(ctx, chunk, p, end)) return false;
     } else {
-      set_error(ctx, "CNTB: unexpected chunk '%s'", cid.c_str());
+      set_error(ctx, "CNTB: unexpected chunk '%.*s'", chunk.len, chunk.str);
       return false;
     }
   }
@@ -392,9 +452,9 @@ bool parse_modl_txt(Context* ctx, const char*& p, const char* end)
   // project and name (each a full line)
   const char *ls = nullptr, *le = nullptr;
   if (!read_line(ls, le, p, end)) { set_error(ctx, "MODL: missing project"); return false; }
-  m->model.project = intern_line_as_string(ctx->store, ls, le);
+  m->model.project = intern_line_as_string(ctx, ls, le);
   if (!read_line(ls, le, p, end)) { set_error(ctx, "MODL: missing name"); return false; }
-  m->model.name = intern_line_as_string(ctx->store, ls, le);
+  m->model.name = intern_line_as_string(ctx, ls, le);
 
   return true;
 }
@@ -411,18 +471,201 @@ bool parse_head_txt(Context* ctx, const char*& p, const char* end)
 
   const char *ls = nullptr, *le = nullptr;
   if (!read_line(ls, le, p, end)) { set_error(ctx, "HEAD: missing info"); return false; }
-  f->file.info = intern_line_as_string(ctx->store, ls, le);
+  f->file.info = intern_line_as_string(ctx, ls, le);
   if (!read_line(ls, le, p, end)) { set_error(ctx, "HEAD: missing note"); return false; }
-  f->file.note = intern_line_as_string(ctx->store, ls, le);
+  f->file.note = intern_line_as_string(ctx, ls, le);
   if (!read_line(ls, le, p, end)) { set_error(ctx, "HEAD: missing date"); return false; }
-  f->file.date = intern_line_as_string(ctx->store, ls, le);
+  f->file.date = intern_line_as_string(ctx, ls, le);
   if (!read_line(ls, le, p, end)) { set_error(ctx, "HEAD: missing user"); return false; }
-  f->file.user = intern_line_as_string(ctx->store, ls, le);
+  f->file.user = intern_line_as_string(ctx, ls, le);
 
   // No version/encoding in text; set encoding empty, set path
-  f->file.encoding = ctx->store->strings.intern("");
-  f->file.path = ctx->store->strings.intern(ctx->path ? ctx->path : "");
+  f->file.encoding = ctx->strings->intern("");
+  f->file.path = ctx->strings->intern(ctx->path ? ctx->path : "");
+
+  return true;
+}
+
+// Top-level CNTB..CNTE groups are independent of each other, so large files are split on
+// those and parsed concurrently into separate stores, which are then linked into the
+// destination store in file order.
+constexpr size_t parallelBytesPerThread = 4 * 1024 * 1024;
+
+struct GroupRange
+{
+  const char* begin;  // Start of the CNTB id line
+  const char* end;    // Just past the header line of the matching CNTE
+};
+
+// Finds the top-level groups by looking at line starts only. Apart from the lines following
+// HEAD, MODL and CNTB, which are skipped, every line is either a chunk id or numbers, so the
+// chunk ids give the nesting. Stops at END:. Returns false if the nesting does not add up, the
+// sequential parser will then report a proper error.
+bool find_top_level_groups(std::vector<GroupRange>& ranges, const char* p, const char* end)
+{
+  const char* groupBegin = nullptr;
+  unsigned depth = 0;
+  unsigned skip = 0;
+  bool closePending = false;
+  while (p < end) {
+    const char* ls = p;
+    const char* le = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (le == nullptr) le = end;
+    p = le < end ? le + 1 : end;
+
+    if (skip) {
+      if (--skip == 0 && closePending) {
+        ranges.push_back({ groupBegin, p });
+        closePending = false;
+      }
+      continue;
+    }
+
+    while (ls < le && (*ls == ' ' || *ls == '\t')) ++ls;
+    while (ls < le && std::isspace(static_cast<unsigned char>(le[-1]))) --le;
+    if (le - ls != 4) continue;
+
+    switch (id(ls)) {
+    case id("HEAD"): skip = 5; break;
+    case id("MODL"): skip = 3; break;
+    case id("CNTB"):
+      if (depth++ == 0) groupBegin = ls;
+      skip = 2;
+      break;
+    case id("CNTE"):
+      if (depth == 0) return false;
+      closePending = --depth == 0;
+      skip = 1;
+      break;
+    case id("PRIM"): case id("OBST"): case id("INSU"):
+      if (depth == 0) return false;
+      skip = 1;
+      break;
+    case id("END:"):
+      return depth == 0 && !closePending;
+    default:
+      break;  // Numbers like nan or inf
+    }
+  }
+  return depth == 0 && !closePending;
+}
+
+struct GroupBatch
+{
+  Store* store = nullptr;
+  Node* parent = nullptr;                 // Placeholder group the top-level groups are parsed into
+  size_t rangeBegin = 0;
+  size_t rangeEnd = 0;
+  std::vector<unsigned> firstGeometryIds; // Per range, plus one past the last
+  bool ok = false;
+};
 
+void parse_group_batch(GroupBatch& batch, const std::vector<GroupRange>& ranges, const char* path, StringInterning* strings)
+{
+  char buf[1024];
+  Context ctx;
+  ctx.store = batch.store;
+  ctx.path = path;
+  ctx.strings = strings;
+  ctx.errbuf = buf;
+  ctx.errbuf_size = sizeof(buf);
+  ctx.stack.push_back(batch.parent);
+
+  for (size_t i = batch.rangeBegin; i < batch.rangeEnd; i++) {
+    batch.firstGeometryIds.push_back(batch.store->geometryCountAllocated());
+
+    const char* p = ranges[i].begin;
+    const char* end = ranges[i].end;
+    ChunkId chunk;
+    if (!read_chunk_header_txt(chunk, p, end) || chunk.id != id("CNTB")) {
+      set_error(&ctx, "Expected CNTB at start of group");
+      return;
+    }
+    if (!parse_cntb_txt(&ctx, p, end)) return;
+  }
+  batch.firstGeometryIds.push_back(batch.store->geometryCountAllocated());
+  batch.ok = true;
+}
+
+// Splits the ranges into contiguous batches of about the same byte size and parses them
+// concurrently. Names are interned directly into the string table of the destination store,
+// whose arenas later adopt the pages of the batch stores.
+void parse_groups_concurrently(std::vector<GroupBatch>& batches, const std::vector<GroupRange>& ranges,
+                               const char* path, Store* store, size_t threadCount)
+{
+  StringInterning* strings = &store->strings;
+  threadCount = std::min(threadCount, ranges.size());
+  if (threadCount < 2) return;
+
+  size_t rangeBytes = static_cast<size_t>(ranges.back().end - ranges.front().begin);
+  batches.resize(threadCount);
+  size_t r = 0;
+  for (size_t t = 0; t < threadCount; t++) {
+    GroupBatch& batch = batches[t];
+    batch.store = new Store();
+    batch.store->copyArenaSettings(*store);
+    batch.parent = batch.store->newNode(nullptr, Node::Kind::Group);
+    batch.rangeBegin = r;
+    const char* target = ranges.front().begin + (rangeBytes * (t + 1)) / threadCount;
+    while (r < ranges.size() && (ranges[r].end <= target || t + 1 == threadCount)) r++;
+    batch.rangeEnd = r;
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < threadCount; t++) {
+    threads.emplace_back(parse_group_batch, std::ref(batches[t]), std::cref(ranges), path, strings);
+  }
+  parse_group_batch(batches[0], ranges, path, strings);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+bool parse_top_level_txt(Context* ctx, const char*& p, const char* end,
+                         const std::vector<GroupRange>& ranges, std::vector<GroupBatch>& batches)
+{
+  size_t nextRange = 0;
+  size_t nextBatch = 0;
+  ChunkId chunk;
+  while (p < end) {
+    const char* chunkBegin = p;
+    while (chunkBegin < end && std::isspace(static_cast<unsigned char>(*chunkBegin))) ++chunkBegin;
+
+    if (!read_chunk_header_txt(chunk, p, end)) { set_error(ctx, "Unexpected EOF while reading top-level chunks"); return false; }
+    if (chunk.id == id("END:")) {
+      // Pop model if left on stack
+      if (!ctx->stack.empty() && ctx->stack.back()->kind == Node::Kind::Model) ctx->stack.pop_back();
+      break;
+    } else if (chunk.id == id("MODL")) {
+      if (!parse_modl_txt(ctx, p, end)) return false;
+    } else if (chunk.id == id("CNTB") && !batches.empty() && nextRange < ranges.size() && ranges[nextRange].begin == chunkBegin) {
+      // Already parsed concurrently, link it in.
+      if (ctx->stack.empty() || ctx->stack.back()->kind != Node::Kind::Model) {
+        set_error(ctx, "CNTB without valid parent (Model/Group)");
+        return false;
+      }
+      while (batches[nextBatch].rangeEnd <= nextRange) nextBatch++;
+      GroupBatch& batch = batches[nextBatch];
+      size_t i = nextRange - batch.rangeBegin;
+      Node* group = batch.parent->children.popFront();
+      assert(group);
+      ctx->store->adoptNode(ctx->stack.back(), group, batch.firstGeometryIds[i],
+                            batch.firstGeometryIds[i + 1] - batch.firstGeometryIds[i]);
+      p = ranges[nextRange++].end;
+    } else if (chunk.id == id("CNTB")) {
+      if (!parse_cntb_txt(ctx, p, end)) return false;
+    } else if (chunk.id == id("CNTE")) {
+      // Some producers might put stray CNTE (rare). We can skip but warn.
+      ctx->logger(1, "parseREV: Unexpected CNTE at root level, ignoring.");
+    } else if (chunk.id == id("PRIM") || chunk.id == id("OBST") || chunk.id == id("INSU")) {
+      // Should not appear at root; but if it does, error
+      set_error(ctx, "Geometry chunk '%.*s' outside of any group", chunk.len, chunk.str);
+      return false;
+    } else {
+      set_error(ctx, "Unrecognized chunk '%.*s'", chunk.len, chunk.str);
+      return false;
+    }
+  }
   return true;
 }
 
@@ -435,6 +678,7 @@ bool parseREV(Store* store, Logger logger, const char* path, const void* ptr, si
   ctx.store = store;
   ctx.logger = logger;
   ctx.path = path;
+  ctx.strings = &store->strings;
   ctx.errbuf = buf;
   ctx.errbuf_size = sizeof(buf);
 
@@ -442,35 +686,42 @@ bool parseREV(Store* store, Logger logger, const char* path, const void* ptr, si
   const char* p = base;
   const char* end = base + size;
 
+  auto time0 = std::chrono::high_resolution_clock::now();
+
   // First chunk must be HEAD
-  std::string id;
-  if (!read_chunk_header_txt(id, p, end)) { set_error(&ctx, "Empty or invalid file"); return false; }
-  if (id != "HEAD") { set_error(&ctx, "Expected HEAD, got '%s'", id.c_str()); return false; }
+  ChunkId chunk;
+  if (!read_chunk_header_txt(chunk, p, end)) { set_error(&ctx, "Empty or invalid file"); return false; }
+  if (chunk.id != id("HEAD")) { set_error(&ctx, "Expected HEAD, got '%.*s'", chunk.len, chunk.str); return false; }
   if (!parse_head_txt(&ctx, p, end)) return false;
 
   // Next chunks: MODL, CNTB..., END:
-  while (p < end) {
-    if (!read_chunk_header_txt(id, p, end)) { set_error(&ctx, "Unexpected EOF while reading top-level chunks"); return false; }
-    if (id == "END:") {
-      // Pop model if left on stack
-      if (!ctx.stack.empty() && ctx.stack.back()->kind == Node::Kind::Model) ctx.stack.pop_back();
+  std::vector<GroupRange> ranges;
+  std::vector<GroupBatch> batches;
+  size_t threadCount = std::min(size_t(std::thread::hardware_concurrency()), size / parallelBytesPerThread);
+  if (1 < threadCount && find_top_level_groups(ranges, p, end)) {
+    parse_groups_concurrently(batches, ranges, path, store, threadCount);
+  }
+  bool ok = true;
+  for (auto& batch : batches) {
+    if (!batch.ok) {
+      store->setErrorString(batch.store->errorString());
+      ok = false;
       break;
-    } else if (id == "MODL") {
-      if (!parse_modl_txt(&ctx, p, end)) return false;
-    } else if (id == "CNTB") {
-      if (!parse_cntb_txt(&ctx, p, end)) return false;
-    } else if (id == "CNTE") {
-      // Some producers might put stray CNTE (rare). We can skip but warn.
-      ctx.logger(1, "parseREV: Unexpected CNTE at root level, ignoring.");
-    } else if (id == "PRIM" || id == "OBST" || id == "INSU") {
-      // Should not appear at root; but if it does, error
-      set_error(&ctx, "Geometry chunk '%s' outside of any group", id.c_str());
-      return false;
-    } else {
-      set_error(&ctx, "Unrecognized chunk '%s'", id.c_str());
-      return false;
     }
   }
+  if (ok) {
+    ok = parse_top_level_txt(&ctx, p, end, ranges, batches);
+  }
+  for (auto& batch : batches) {
+    store->arena.adopt(batch.store->arena);
+    delete batch.store;
+  }
+  if (!ok) return false;
+
+  double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - time0).count();
+  double megabytes = static_cast<double>(p - base) / (1024.0 * 1024.0);
+  ctx.logger(0, "parseREV: %s: %.1f MB in %.0fms (%.1f MB/s, %zu threads)", path ? path : "", megabytes, 1000.0 * seconds,
+             0.0 < seconds ? megabytes / seconds : 0.0, std::max(size_t(1), batches.size()));
 
   // Clean stack: should have just [File] or empty after popping
   if (!ctx.stack.empty() && ctx.stack.back()->kind == Node::Kind::Model) ctx.stack.pop_back();